@@ -0,0 +1,109 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+// helpers shared by the benchmark programs
+//
+// each program builds its own data, times the operation it is about and
+// prints one line per measurement; none of them touch book_review.sqlite.
+
+inline double secondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// the p-th percentile ( 0..100 ) of a set of samples, nearest rank
+inline double percentile(std::vector<double> samples, double p)
+{
+    if (samples.empty())
+        return 0;
+    std::sort(samples.begin(), samples.end());
+    size_t rank = static_cast<size_t>(p / 100.0 * (samples.size() - 1) + 0.5);
+    return samples[std::min(rank, samples.size() - 1)];
+}
+
+// resident set size of this process in kB, 0 when /proc is not there
+inline long residentKb()
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, 6, "VmRSS:") == 0)
+            return std::atol(line.c_str() + 6);
+    }
+    return 0;
+}
+
+// a deterministic pseudo-random stream, so runs are comparable
+class BenchRandom
+{
+public:
+    explicit BenchRandom(uint64_t seed) : state_(seed * 0x9e3779b97f4a7c15ULL + 1) {}
+
+    uint64_t next()
+    {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return state_;
+    }
+
+    // in [0, bound)
+    uint32_t below(uint32_t bound)
+    {
+        return static_cast<uint32_t>(next() % bound);
+    }
+
+private:
+    uint64_t state_;
+};
+
+// made-up words, drawn with a skew toward the first ones like real text
+class BenchVocabulary
+{
+public:
+    BenchVocabulary(BenchRandom &random, size_t size)
+    {
+        static const char letters[] = "etaoinshrdlcumwfgypbvkjxqz";
+        words_.reserve(size);
+        for (size_t i = 0; i < size; ++i)
+        {
+            std::string word;
+            int length = 3 + random.below(7);
+            for (int c = 0; c < length; ++c)
+                word += letters[random.below(26)];
+            words_.push_back(std::move(word));
+        }
+    }
+
+    const std::string &word(BenchRandom &random) const
+    {
+        uint32_t size = static_cast<uint32_t>(words_.size());
+        return words_[std::min(random.below(size), random.below(size))];
+    }
+
+    // `count` words separated by spaces
+    std::string text(BenchRandom &random, int count) const
+    {
+        std::string text;
+        for (int i = 0; i < count; ++i)
+        {
+            if (i)
+                text += ' ';
+            text += word(random);
+        }
+        return text;
+    }
+
+private:
+    std::vector<std::string> words_;
+};
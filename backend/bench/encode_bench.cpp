@@ -0,0 +1,108 @@
+// encoding the /books document: size and time per format
+//
+// the rows are built in memory first, so only the encoders are timed. with
+// crow on the include path crow::json::wvalue::dump is measured next to the
+// streaming writers.
+//
+// usage: bench_encode [books] [rounds]
+
+#include "../book_listing.h"
+#include "../response_format.h"
+#include "bench.h"
+#if __has_include("crow.h")
+#include "crow.h"
+#define BENCH_WITH_CROW 1
+#endif
+
+struct BenchBook
+{
+    int64_t id;
+    std::string title;
+    std::string image;
+    std::string summary;
+};
+
+template <class Writer>
+static void writeBooks(const std::vector<BenchBook> &books, Writer &writer)
+{
+    writer.beginArray();
+    for (const auto &book : books)
+    {
+        writer.beginObject(4);
+        writer.key("id");
+        writer.integer(book.id);
+        writer.key("title");
+        writer.string(book.title.data(), book.title.size());
+        writer.key("image");
+        writer.string(book.image.data(), book.image.size());
+        writer.key("summary");
+        writer.string(book.summary.data(), book.summary.size());
+        writer.endObject();
+    }
+    writer.endArray();
+}
+
+// best of `rounds` runs, in ms, and the size of the last body
+template <class Encode>
+static void measure(const char *name, int rounds, Encode encode)
+{
+    std::vector<double> ms;
+    size_t bytes = 0;
+    for (int i = 0; i < rounds; ++i)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::string body = encode();
+        ms.push_back(secondsSince(start) * 1000);
+        bytes = body.size();
+    }
+    std::printf("%-22s %10zu bytes  best %8.3f ms  median %8.3f ms\n", name, bytes, percentile(ms, 0), percentile(ms, 50));
+}
+
+int main(int argc, char *argv[])
+{
+    size_t count = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000;
+    int rounds = argc > 2 ? std::atoi(argv[2]) : 50;
+
+    BenchRandom random(38);
+    BenchVocabulary vocabulary(random, 20000);
+    std::vector<BenchBook> books;
+    books.reserve(count);
+    for (size_t i = 0; i < count; ++i)
+    {
+        std::string summary = vocabulary.text(random, 60);
+        if (summary.size() > kSummaryDefaultMax)
+            summary = summary.substr(0, kSummaryDefaultMax) + "...";
+        books.push_back({static_cast<int64_t>(i + 1), vocabulary.text(random, 1 + random.below(6)),
+                         "https://covers.example.org/" + std::to_string(i + 1) + ".jpg", std::move(summary)});
+    }
+    std::printf("%zu books, %d rounds\n", count, rounds);
+
+    measure("json (JsonWriter)", rounds, [&]()
+            { return encodeBody(ResponseFormat::Json, [&](auto &writer)
+                                { writeBooks(books, writer); }); });
+    measure("msgpack", rounds, [&]()
+            { return encodeBody(ResponseFormat::MsgPack, [&](auto &writer)
+                                { writeBooks(books, writer); }); });
+    measure("cbor", rounds, [&]()
+            { return encodeBody(ResponseFormat::Cbor, [&](auto &writer)
+                                { writeBooks(books, writer); }); });
+#ifdef BENCH_WITH_CROW
+    measure("crow wvalue + dump", rounds, [&]()
+            {
+        crow::json::wvalue list = crow::json::wvalue::list();
+        int index = 0;
+        for (const auto &book : books)
+        {
+            crow::json::wvalue item;
+            item["id"] = book.id;
+            item["title"] = book.title;
+            item["image"] = book.image;
+            item["summary"] = book.summary;
+            list[index++] = std::move(item);
+        }
+        return list.dump(); });
+#else
+    std::printf("crow not on the include path, wvalue::dump not measured\n");
+#endif
+    return 0;
+}
@@ -0,0 +1,135 @@
+// /register duplicate screening: cpu spent per registration attempt
+//
+// fills a scratch users table, loads RegistrationFilter from it and replays a
+// stream of attempts, a share of them for names already taken. three ways of
+// screening are compared:
+//
+//   hash first     bcrypt every attempt, the UNIQUE columns refuse duplicates
+//   query first    an indexed lookup on every attempt, bcrypt only new users
+//   filter         the bloom filter, a lookup only on its "maybe", bcrypt new users
+//
+// filter checks and lookups are timed for the whole stream. bcrypt is timed on
+// a sample of hashes at the server's floor cost and multiplied by the number
+// of hashes each way needs, hashing every attempt would take hours.
+//
+// usage: bench_register [users] [attempts] [duplicate %] [hash samples] [scratch.sqlite]
+
+#include <sqlite3.h>
+#include <cstdio>
+#include "../password_cost.h"
+#include "../registration_filter.h"
+#include "bench.h"
+
+static std::string username(size_t n)
+{
+    return "reader" + std::to_string(n);
+}
+
+static std::string email(size_t n)
+{
+    return "reader" + std::to_string(n) + "@example.org";
+}
+
+static bool fill(const std::string &path, size_t users)
+{
+    std::remove(path.c_str());
+    sqlite3 *db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return false;
+    }
+    sqlite3_exec(db, "CREATE TABLE users (id INTEGER PRIMARY KEY AUTOINCREMENT, username TEXT UNIQUE NOT NULL, email TEXT UNIQUE NOT NULL, "
+                     "is_admin INTEGER NOT NULL DEFAULT 0, password TEXT NOT NULL); BEGIN;",
+                 nullptr, nullptr, nullptr);
+    sqlite3_stmt *insert = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO users (username, email, password) VALUES (?, ?, 'x');", -1, &insert, nullptr);
+    for (size_t n = 0; n < users; ++n)
+    {
+        std::string name = username(n), address = email(n);
+        sqlite3_bind_text(insert, 1, name.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(insert, 2, address.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+    return true;
+}
+
+int main(int argc, char *argv[])
+{
+    size_t users = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t attempts = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100000;
+    uint32_t duplicatePercent = argc > 3 ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 30;
+    int hashSamples = argc > 4 ? std::atoi(argv[4]) : 10;
+    std::string path = argc > 5 ? argv[5] : "bench_register.sqlite";
+
+    if (!fill(path, users))
+        return 1;
+    RegistrationFilter filter;
+    auto start = std::chrono::steady_clock::now();
+    if (!filter.load(path.c_str()))
+        return 1;
+    std::printf("%zu users: filters loaded in %.2f s\n", users, secondsSince(start));
+
+    // the attempts: taken names drawn from the table, new ones past its end
+    BenchRandom random(42);
+    std::vector<size_t> stream;
+    size_t duplicates = 0;
+    for (size_t i = 0; i < attempts; ++i)
+    {
+        bool duplicate = random.below(100) < duplicatePercent;
+        duplicates += duplicate;
+        stream.push_back(duplicate ? random.below(static_cast<uint32_t>(users)) : users + i);
+    }
+
+    sqlite3 *db;
+    sqlite3_open(path.c_str(), &db);
+    std::vector<double> lookupUs;
+    size_t maybes = 0, falsePositives = 0;
+
+    start = std::chrono::steady_clock::now();
+    for (size_t n : stream)
+        maybes += filter.mightBeTaken(username(n), email(n));
+    double filterSeconds = secondsSince(start);
+
+    start = std::chrono::steady_clock::now();
+    for (size_t n : stream)
+    {
+        auto lookup = std::chrono::steady_clock::now();
+        bool taken = userExists(db, username(n), email(n));
+        lookupUs.push_back(secondsSince(lookup) * 1e6);
+        falsePositives += !taken && filter.mightBeTaken(username(n), email(n));
+    }
+    double querySeconds = secondsSince(start);
+    sqlite3_close(db);
+
+    // bcrypt at the floor cost, what every new user pays at least
+    std::vector<double> hashMs;
+    for (int i = 0; i < hashSamples; ++i)
+    {
+        auto hash = std::chrono::steady_clock::now();
+        BCrypt::generateHash("correct horse battery staple", kBcryptMinCost);
+        hashMs.push_back(secondsSince(hash) * 1000);
+    }
+    double hashSeconds = percentile(hashMs, 50) / 1000;
+    double lookupSeconds = querySeconds / attempts;
+    size_t fresh = attempts - duplicates;
+
+    std::printf("%zu attempts, %zu duplicates: filter %.3f us per check, %zu maybes ( %zu false positives, %.2f%% of new names ), "
+                "lookup p50 %.1f us p99 %.1f us, bcrypt cost %d median %.1f ms\n",
+                attempts, duplicates, filterSeconds / attempts * 1e6, maybes, falsePositives, 100.0 * falsePositives / std::max<size_t>(1, fresh),
+                percentile(lookupUs, 50), percentile(lookupUs, 99), kBcryptMinCost, hashSeconds * 1000);
+
+    double hashFirst = attempts * hashSeconds;
+    double queryFirst = querySeconds + fresh * hashSeconds;
+    double filtered = filterSeconds + maybes * lookupSeconds + fresh * hashSeconds;
+    std::printf("cpu seconds for the stream:  hash first %.1f  query first %.1f  filter %.1f  ( saved vs hash first %.1f, %.0f%% )\n",
+                hashFirst, queryFirst, filtered, hashFirst - filtered, 100.0 * (hashFirst - filtered) / hashFirst);
+    std::printf("screening alone:  query first %.3f s  filter %.3f s\n", querySeconds, filterSeconds + maybes * lookupSeconds);
+
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,125 @@
+// full-text search latency at catalog scale
+//
+// fills a scratch database with generated books ( title of 1-6 words,
+// summary of 40 ) and a review per 4 books, builds the fts index the way the
+// server does, then times /search's book query for one word, two words and
+// a two letter prefix, highlighting and encoding included.
+//
+// usage: bench_search [books] [queries] [scratch.sqlite]
+
+#include <sqlite3.h>
+#include <cstdio>
+#include "../json_writer.h"
+#include "../search.h"
+#include "bench.h"
+
+static bool exec(sqlite3 *db, const char *sql)
+{
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, nullptr, &errMsg) != SQLITE_OK)
+    {
+        std::fprintf(stderr, "%s: %s\n", sql, errMsg ? errMsg : "?");
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+static void fill(sqlite3 *db, const BenchVocabulary &vocabulary, BenchRandom &random, size_t books)
+{
+    exec(db, R"(
+        CREATE TABLE users (id INTEGER PRIMARY KEY AUTOINCREMENT, username TEXT UNIQUE NOT NULL, email TEXT UNIQUE NOT NULL,
+                            is_admin INTEGER NOT NULL DEFAULT 0, password TEXT NOT NULL);
+        CREATE TABLE books (id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT NOT NULL, image_url TEXT, summary TEXT);
+        CREATE TABLE reviews (id INTEGER PRIMARY KEY AUTOINCREMENT, user_id INTEGER NOT NULL, book_id INTEGER NOT NULL,
+                              rating INTEGER NOT NULL, comment TEXT, created_at INTEGER, updated_at INTEGER);
+        INSERT INTO users (username, email, password) VALUES ('reader', 'reader@example.org', 'x');
+    )");
+
+    exec(db, "BEGIN;");
+    sqlite3_stmt *book = nullptr, *review = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO books (title, image_url, summary) VALUES (?, NULL, ?);", -1, &book, nullptr);
+    sqlite3_prepare_v2(db, "INSERT INTO reviews (user_id, book_id, rating, comment) VALUES (1, ?, ?, ?);", -1, &review, nullptr);
+    for (size_t i = 0; i < books; ++i)
+    {
+        std::string title = vocabulary.text(random, 1 + random.below(6));
+        std::string summary = vocabulary.text(random, 40);
+        sqlite3_bind_text(book, 1, title.c_str(), static_cast<int>(title.size()), SQLITE_TRANSIENT);
+        sqlite3_bind_text(book, 2, summary.c_str(), static_cast<int>(summary.size()), SQLITE_TRANSIENT);
+        sqlite3_step(book);
+        sqlite3_reset(book);
+        if (i % 4 == 0)
+        {
+            std::string comment = vocabulary.text(random, 20);
+            sqlite3_bind_int64(review, 1, static_cast<int64_t>(i + 1));
+            sqlite3_bind_int(review, 2, 1 + random.below(5));
+            sqlite3_bind_text(review, 3, comment.c_str(), static_cast<int>(comment.size()), SQLITE_TRANSIENT);
+            sqlite3_step(review);
+            sqlite3_reset(review);
+        }
+    }
+    sqlite3_finalize(book);
+    sqlite3_finalize(review);
+    exec(db, "COMMIT;");
+}
+
+static void run(sqlite3 *db, const char *name, const std::vector<std::string> &queries)
+{
+    std::vector<double> ms;
+    size_t bytes = 0;
+    for (const auto &query : queries)
+    {
+        auto start = std::chrono::steady_clock::now();
+        std::string body;
+        JsonWriter writer(body);
+        writer.beginObject(1);
+        searchBooks(db, buildMatchQuery(query), kSearchDefaultLimit, 0, writer);
+        writer.endObject();
+        ms.push_back(secondsSince(start) * 1000);
+        bytes += body.size();
+    }
+    std::printf("%-10s %6zu queries  p50 %7.3f ms  p90 %7.3f ms  p99 %7.3f ms  max %7.3f ms  avg body %zu bytes\n", name, queries.size(),
+                percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), percentile(ms, 100), bytes / queries.size());
+}
+
+int main(int argc, char *argv[])
+{
+    size_t books = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+    std::string path = argc > 3 ? argv[3] : "bench_search.sqlite";
+
+    std::remove(path.c_str());
+    sqlite3 *db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+
+    BenchRandom random(27);
+    BenchVocabulary vocabulary(random, 50000);
+
+    auto start = std::chrono::steady_clock::now();
+    fill(db, vocabulary, random, books);
+    double filled = secondsSince(start);
+    start = std::chrono::steady_clock::now();
+    if (!ensureSearchSchema(db))
+        return 1;
+    std::printf("%zu books: filled in %.1f s, fts index built in %.1f s, rss %ld MB\n", books, filled, secondsSince(start), residentKb() / 1024);
+
+    std::vector<std::string> one, two, prefix;
+    for (size_t i = 0; i < count; ++i)
+    {
+        one.push_back(vocabulary.word(random));
+        two.push_back(vocabulary.word(random) + " " + vocabulary.word(random));
+        prefix.push_back(vocabulary.word(random).substr(0, 2));
+    }
+    run(db, "one word", one); // the first pass also warms the page cache
+    run(db, "one word", one);
+    run(db, "two words", two);
+    run(db, "prefix", prefix);
+
+    sqlite3_close(db);
+    std::remove(path.c_str());
+    return 0;
+}
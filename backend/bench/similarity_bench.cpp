@@ -0,0 +1,102 @@
+// "readers also liked" at catalog scale: full build time and memory
+//
+// fills a scratch database with generated reviews ( book popularity skewed,
+// a few users reviewing a book twice ), then starts ItemSimilarity once per
+// thread count and waits for its first model. while a build runs, review
+// changes keep arriving, and the time each onReviewChanged call takes is
+// recorded: the build must not hold the lock the review routes need. rss is
+// telling for the first thread count only, later runs reuse what it freed.
+//
+// usage: bench_similarity [reviews] [users] [books] [threads,threads,...] [scratch.sqlite]
+
+#include <sqlite3.h>
+#include <cstdio>
+#include <iostream>
+#include <sstream>
+#include "../item_similarity.h"
+#include "bench.h"
+
+static bool fill(const std::string &path, size_t reviews, uint32_t users, uint32_t books)
+{
+    std::remove(path.c_str());
+    sqlite3 *db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return false;
+    }
+    sqlite3_exec(db, "CREATE TABLE reviews (id INTEGER PRIMARY KEY AUTOINCREMENT, user_id INTEGER NOT NULL, book_id INTEGER NOT NULL, "
+                     "rating INTEGER NOT NULL, comment TEXT, created_at INTEGER, updated_at INTEGER); BEGIN;",
+                 nullptr, nullptr, nullptr);
+    sqlite3_stmt *insert = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO reviews (user_id, book_id, rating) VALUES (?, ?, ?);", -1, &insert, nullptr);
+    BenchRandom random(31);
+    for (size_t i = 0; i < reviews; ++i)
+    {
+        // readers are skewed too: min of two draws, so some have hundreds of reviews
+        uint32_t user = 1 + std::min(random.below(users), random.below(users));
+        uint32_t book = 1 + std::min(random.below(books), random.below(books));
+        sqlite3_bind_int(insert, 1, static_cast<int>(user));
+        sqlite3_bind_int(insert, 2, static_cast<int>(book));
+        sqlite3_bind_int(insert, 3, 1 + random.below(5));
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+    }
+    sqlite3_finalize(insert);
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+    return true;
+}
+
+static void run(const std::string &path, size_t threads, uint32_t users, uint32_t books)
+{
+    long rssBefore = residentKb();
+    auto start = std::chrono::steady_clock::now();
+    ItemSimilarity similarity;
+    similarity.start(path.c_str(), std::chrono::milliseconds(1), threads);
+    double loaded = secondsSince(start);
+
+    // book 1 is the most reviewed, it has neighbours once the first model is out
+    BenchRandom random(threads);
+    std::vector<double> us;
+    int reviewId = 1 << 30;
+    while (similarity.similar(1, 1).empty())
+    {
+        catalog::ReviewChange change{};
+        change.kind = catalog::ReviewChange::Kind::Added;
+        change.review_id = reviewId++;
+        change.user_id = 1 + static_cast<int>(random.below(users));
+        change.book_id = 1 + static_cast<int>(random.below(books));
+        change.rating = 1 + static_cast<int>(random.below(5));
+        auto call = std::chrono::steady_clock::now();
+        similarity.onReviewChanged(change);
+        us.push_back(secondsSince(call) * 1e6);
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    std::printf("%zu threads: loaded in %.1f s, first model after %.1f s, rss grew %ld MiB; "
+                "%zu review changes meanwhile, onReviewChanged p50 %.1f us max %.1f us\n",
+                threads, loaded, secondsSince(start), (residentKb() - rssBefore) >> 10, us.size(), percentile(us, 50), percentile(us, 100));
+}
+
+int main(int argc, char *argv[])
+{
+    size_t reviews = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000000;
+    uint32_t users = argc > 2 ? static_cast<uint32_t>(std::strtoul(argv[2], nullptr, 10)) : 1000000;
+    uint32_t books = argc > 3 ? static_cast<uint32_t>(std::strtoul(argv[3], nullptr, 10)) : 200000;
+    std::string threadList = argc > 4 ? argv[4] : "1,2,4";
+    std::string path = argc > 5 ? argv[5] : "bench_similarity.sqlite";
+
+    auto start = std::chrono::steady_clock::now();
+    if (!fill(path, reviews, users, books))
+        return 1;
+    std::printf("%zu reviews, %u users, %u books: filled in %.1f s, %u cores\n", reviews, users, books, secondsSince(start),
+                std::thread::hardware_concurrency());
+
+    std::stringstream list(threadList);
+    std::string threads;
+    while (std::getline(list, threads, ','))
+        run(path, std::strtoul(threads.c_str(), nullptr, 10), users, books);
+
+    std::remove(path.c_str());
+    return 0;
+}
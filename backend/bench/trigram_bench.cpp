@@ -0,0 +1,140 @@
+// fuzzy title search at catalog scale: query latency and index memory
+//
+// fills a scratch database with generated titles ( 1-6 words ), builds the
+// trigram index from it like the server does, and times searches for real
+// titles with one or two typos. the sorted-set intersection is also timed on
+// its own, scalar against avx2.
+//
+// usage: bench_trigram [titles] [queries] [scratch.sqlite]
+
+#include <sqlite3.h>
+#include <cstdio>
+#include "../trigram_index.h"
+#include "bench.h"
+
+// a title with `typos` random substitutions, deletions or swaps
+static std::string misspell(std::string title, int typos, BenchRandom &random)
+{
+    for (int t = 0; t < typos && title.size() > 3; ++t)
+    {
+        size_t at = random.below(static_cast<uint32_t>(title.size() - 1));
+        switch (random.below(3))
+        {
+        case 0:
+            title[at] = static_cast<char>('a' + random.below(26));
+            break;
+        case 1:
+            title.erase(at, 1);
+            break;
+        default:
+            std::swap(title[at], title[at + 1]);
+        }
+    }
+    return title;
+}
+
+static void run(const TrigramIndex &index, const char *name, const std::vector<std::string> &queries)
+{
+    std::vector<double> ms;
+    size_t found = 0;
+    for (const auto &query : queries)
+    {
+        auto start = std::chrono::steady_clock::now();
+        auto matches = index.search(query, 10);
+        ms.push_back(secondsSince(start) * 1000);
+        found += !matches.empty();
+    }
+    std::printf("%-10s %6zu queries  p50 %7.3f ms  p90 %7.3f ms  p99 %7.3f ms  max %7.3f ms  with matches %zu\n", name, queries.size(),
+                percentile(ms, 50), percentile(ms, 90), percentile(ms, 99), percentile(ms, 100), found);
+}
+
+static void intersections(BenchRandom &random)
+{
+    // two lists of 100k and 400k doc numbers out of 1M
+    auto list = [&random](size_t size)
+    {
+        std::vector<uint32_t> values;
+        for (size_t i = 0; i < size; ++i)
+            values.push_back(random.below(1000000));
+        std::sort(values.begin(), values.end());
+        values.erase(std::unique(values.begin(), values.end()), values.end());
+        return values;
+    };
+    std::vector<uint32_t> a = list(100000), b = list(400000), out(a.size());
+
+    auto time = [&](const char *name, size_t (*intersect)(const uint32_t *, size_t, const uint32_t *, size_t, uint32_t *))
+    {
+        std::vector<double> us;
+        size_t n = 0;
+        for (int round = 0; round < 50; ++round)
+        {
+            auto start = std::chrono::steady_clock::now();
+            n = intersect(a.data(), a.size(), b.data(), b.size(), out.data());
+            us.push_back(secondsSince(start) * 1e6);
+        }
+        std::printf("intersect %-7s %zu x %zu -> %zu  median %8.1f us\n", name, a.size(), b.size(), n, percentile(us, 50));
+    };
+    time("scalar", intersectScalar);
+#ifdef TRIGRAM_HAVE_X86
+    if (__builtin_cpu_supports("avx2"))
+        time("avx2", intersectAvx2);
+#endif
+}
+
+int main(int argc, char *argv[])
+{
+    size_t titles = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 1000000;
+    size_t count = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 2000;
+    std::string path = argc > 3 ? argv[3] : "bench_trigram.sqlite";
+
+    std::remove(path.c_str());
+    sqlite3 *db;
+    if (sqlite3_open(path.c_str(), &db) != SQLITE_OK)
+    {
+        std::fprintf(stderr, "cannot open %s\n", path.c_str());
+        return 1;
+    }
+
+    BenchRandom random(29);
+    BenchVocabulary vocabulary(random, 50000);
+    std::vector<std::string> sample;
+    sqlite3_exec(db, "CREATE TABLE books (id INTEGER PRIMARY KEY AUTOINCREMENT, title TEXT NOT NULL, image_url TEXT, summary TEXT); BEGIN;",
+                 nullptr, nullptr, nullptr);
+    sqlite3_stmt *insert = nullptr;
+    sqlite3_prepare_v2(db, "INSERT INTO books (title) VALUES (?);", -1, &insert, nullptr);
+    for (size_t i = 0; i < titles; ++i)
+    {
+        std::string title = vocabulary.text(random, 1 + random.below(6));
+        sqlite3_bind_text(insert, 1, title.c_str(), static_cast<int>(title.size()), SQLITE_TRANSIENT);
+        sqlite3_step(insert);
+        sqlite3_reset(insert);
+        if (sample.size() < count && random.below(static_cast<uint32_t>(titles / count + 1)) == 0)
+            sample.push_back(std::move(title));
+    }
+    sqlite3_finalize(insert);
+    sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr);
+    sqlite3_close(db);
+
+    long rssBefore = residentKb();
+    TrigramIndex index;
+    auto start = std::chrono::steady_clock::now();
+    if (!index.build(path.c_str()))
+        return 1;
+    std::printf("%zu titles: built in %.2f s, index %zu MiB ( rss grew %ld MiB )\n", titles, secondsSince(start),
+                index.memoryBytes() >> 20, (residentKb() - rssBefore) >> 10);
+
+    std::vector<std::string> exact, oneTypo, twoTypos;
+    for (const auto &title : sample)
+    {
+        exact.push_back(title);
+        oneTypo.push_back(misspell(title, 1, random));
+        twoTypos.push_back(misspell(title, 2, random));
+    }
+    run(index, "exact", exact);
+    run(index, "1 typo", oneTypo);
+    run(index, "2 typos", twoTypos);
+    intersections(random);
+
+    std::remove(path.c_str());
+    return 0;
+}
@@ -0,0 +1,142 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <array>
+#include <cstdint>
+#include <string>
+#include <utility>
+
+// the /books listing with sparse fieldsets ( ?fields=id,title,image )
+//
+// only the requested columns are selected, and the row writer is a template
+// over the field set, so each of the 15 possible sets gets its own loop with
+// no per-row checks for fields it does not carry. the writer picks the
+// runtime set's instantiation from a table.
+
+enum BookField : unsigned
+{
+    BookFieldId = 1,
+    BookFieldTitle = 2,
+    BookFieldImage = 4,
+    BookFieldSummary = 8
+};
+
+constexpr unsigned kAllBookFields = BookFieldId | BookFieldTitle | BookFieldImage | BookFieldSummary;
+constexpr int kSummaryDefaultMax = 300; // characters, 0 sends full summaries
+
+// reading "id,title,image,summary" ( any subset, any order ) into a mask
+//
+inline bool parseBookFields(const std::string &fields, unsigned &mask)
+{
+    mask = 0;
+    size_t start = 0;
+    while (start <= fields.size())
+    {
+        size_t end = fields.find(',', start);
+        if (end == std::string::npos)
+            end = fields.size();
+        std::string name = fields.substr(start, end - start);
+        if (name == "id")
+            mask |= BookFieldId;
+        else if (name == "title")
+            mask |= BookFieldTitle;
+        else if (name == "image")
+            mask |= BookFieldImage;
+        else if (name == "summary")
+            mask |= BookFieldSummary;
+        else
+            return false;
+        start = end + 1;
+    }
+    return mask != 0;
+}
+
+// select list for a field set, columns always in id, title, image, summary order
+//
+inline std::string bookListingSql(unsigned fields, int summaryMax)
+{
+    std::string columns;
+    auto add = [&columns](const std::string &column)
+    {
+        columns += columns.empty() ? column : ", " + column;
+    };
+    if (fields & BookFieldId)
+        add("id");
+    if (fields & BookFieldTitle)
+        add("title");
+    if (fields & BookFieldImage)
+        add("image_url");
+    if (fields & BookFieldSummary)
+    {
+        // substr counts characters, so truncation never splits a utf-8 sequence
+        std::string max = std::to_string(summaryMax);
+        add(summaryMax > 0 ? "CASE WHEN length(summary) > " + max + " THEN substr(summary, 1, " + max + ") || '...' ELSE summary END" : "summary");
+    }
+    return "SELECT " + columns + " FROM books;";
+}
+
+// result column of a field, given the fields selected before it
+template <unsigned Fields>
+constexpr int bookColumn(unsigned field)
+{
+    int column = 0;
+    for (unsigned bit = 1; bit < field; bit <<= 1)
+    {
+        if (Fields & bit)
+            ++column;
+    }
+    return column;
+}
+
+template <unsigned Fields, class Writer>
+void writeBookText(sqlite3_stmt *stmt, Writer &out, const char *name, unsigned field)
+{
+    int column = bookColumn<Fields>(field);
+    const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+    out.key(name);
+    out.string(text ? text : "", text ? static_cast<size_t>(sqlite3_column_bytes(stmt, column)) : 0);
+}
+
+// writing every row of a prepared bookListingSql(Fields) statement as an array
+//
+template <unsigned Fields, class Writer>
+bool writeBookRows(sqlite3_stmt *stmt, Writer &out)
+{
+    constexpr size_t fieldCount = ((Fields & 1) != 0) + ((Fields & 2) != 0) + ((Fields & 4) != 0) + ((Fields & 8) != 0);
+
+    int rc;
+    out.beginArray();
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        out.beginObject(fieldCount);
+        if constexpr ((Fields & BookFieldId) != 0)
+        {
+            out.key("id");
+            out.integer(sqlite3_column_int64(stmt, bookColumn<Fields>(BookFieldId)));
+        }
+        if constexpr ((Fields & BookFieldTitle) != 0)
+            writeBookText<Fields>(stmt, out, "title", BookFieldTitle);
+        if constexpr ((Fields & BookFieldImage) != 0)
+            writeBookText<Fields>(stmt, out, "image", BookFieldImage);
+        if constexpr ((Fields & BookFieldSummary) != 0)
+            writeBookText<Fields>(stmt, out, "summary", BookFieldSummary);
+        out.endObject();
+    }
+    out.endArray();
+    return rc == SQLITE_DONE;
+}
+
+template <class Writer, size_t... Sets>
+constexpr auto bookRowWriters(std::index_sequence<Sets...>)
+{
+    return std::array<bool (*)(sqlite3_stmt *, Writer &), sizeof...(Sets)>{&writeBookRows<Sets, Writer>...};
+}
+
+// dispatching a runtime field set to its instantiation
+//
+template <class Writer>
+bool writeBookRows(unsigned fields, sqlite3_stmt *stmt, Writer &out)
+{
+    static constexpr auto writers = bookRowWriters<Writer>(std::make_index_sequence<kAllBookFields + 1>());
+    return writers[fields & kAllBookFields](stmt, out);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <mutex>
+#include <vector>
+
+// catalog change notifications
+//
+// anything that keeps derived catalog data in memory (indexes, serialized
+// lists, ...) registers a listener here, so write paths only have to announce
+// a change once instead of knowing about every cache
+namespace catalog
+{
+    using BooksListener = std::function<void()>;
+
+    // one review written by the review routes
+    struct ReviewChange
+    {
+        enum class Kind
+        {
+            Added,
+            Edited,
+            Deleted
+        };
+
+        Kind kind;
+        int review_id;
+        int book_id;
+        int user_id;
+        int rating;     // rating after the change ( the removed rating for Deleted )
+        int old_rating; // rating before the change ( Edited only )
+        int64_t timestamp; // unix time of the write ( the review's created_at for Deleted, 0 if unknown )
+        std::string username;
+        std::string comment; // empty for Deleted
+    };
+
+    using ReviewListener = std::function<void(const ReviewChange &)>;
+
+    inline std::mutex listenersMutex;
+    inline std::vector<BooksListener> booksListeners;
+    inline std::vector<ReviewListener> reviewListeners;
+
+    // register a callback for "the books table changed"
+    //
+    inline void onBooksChanged(BooksListener listener)
+    {
+        std::lock_guard<std::mutex> lock(listenersMutex);
+        booksListeners.push_back(std::move(listener));
+    }
+
+    // announce a books table change ( call once per write, not once per row )
+    //
+    inline void notifyBooksChanged()
+    {
+        std::vector<BooksListener> listeners;
+        {
+            std::lock_guard<std::mutex> lock(listenersMutex);
+            listeners = booksListeners;
+        }
+        for (auto &listener : listeners)
+        {
+            listener();
+        }
+    }
+
+    // register a callback for review inserts, edits and deletes
+    //
+    inline void onReviewChanged(ReviewListener listener)
+    {
+        std::lock_guard<std::mutex> lock(listenersMutex);
+        reviewListeners.push_back(std::move(listener));
+    }
+
+    // announce a committed review change
+    //
+    inline void notifyReviewChanged(const ReviewChange &change)
+    {
+        std::vector<ReviewListener> listeners;
+        {
+            std::lock_guard<std::mutex> lock(listenersMutex);
+            listeners = reviewListeners;
+        }
+        for (auto &listener : listeners)
+        {
+            listener(change);
+        }
+    }
+}
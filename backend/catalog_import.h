@@ -0,0 +1,531 @@
+#pragma once
+
+#include "crow.h"
+#include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <iostream>
+#include <istream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "catalog_events.h"
+
+// bulk catalog import
+//
+// books are read from a CSV ( with a header row ) or NDJSON stream one batch
+// at a time, so memory stays constant no matter how big the input is. each
+// batch is validated in parallel and inserted in a single transaction. no
+// record is read past kImportMaxRecord bytes, so an unterminated quote or a
+// file without newlines cannot pull the whole input into memory.
+
+enum class ImportFormat
+{
+    CSV,
+    NDJSON
+};
+
+struct ImportRow
+{
+    size_t line = 0;
+    std::string title;
+    std::string image_url;
+    std::string summary;
+    std::string error; // empty when the row is valid
+};
+
+struct ImportStats
+{
+    size_t parsed = 0;
+    size_t inserted = 0;
+    size_t rejected = 0;
+    double seconds = 0;
+    std::vector<std::string> errors; // first few rejections, for the report
+
+    double rowsPerSecond() const
+    {
+        return seconds > 0 ? inserted / seconds : 0;
+    }
+};
+
+// limits applied by validateImportRow
+//
+constexpr size_t kImportMaxTitle = 512;
+constexpr size_t kImportMaxImageUrl = 2048;
+constexpr size_t kImportMaxSummary = 64 * 1024;
+constexpr size_t kImportMaxErrors = 20;
+constexpr int kImportBeginAttempts = 3; // each waits out the busy timeout
+constexpr size_t kImportMaxRecord = 1024 * 1024; // one CSV record or NDJSON line, escapes included
+
+inline std::string trimCopy(const std::string &s)
+{
+    size_t begin = 0, end = s.size();
+    while (begin < end && std::isspace(static_cast<unsigned char>(s[begin])))
+        ++begin;
+    while (end > begin && std::isspace(static_cast<unsigned char>(s[end - 1])))
+        --end;
+    return s.substr(begin, end - begin);
+}
+
+inline bool isValidUtf8(const std::string &s)
+{
+    size_t i = 0;
+    while (i < s.size())
+    {
+        unsigned char c = s[i];
+        int extra = c < 0x80 ? 0 : (c >> 5) == 0x6 ? 1 : (c >> 4) == 0xE ? 2 : (c >> 3) == 0x1E ? 3 : -1;
+        if (extra < 0 || i + extra >= s.size())
+            return false;
+        for (int k = 1; k <= extra; ++k)
+        {
+            if ((static_cast<unsigned char>(s[i + k]) >> 6) != 0x2)
+                return false;
+        }
+        i += extra + 1;
+    }
+    return true;
+}
+
+// validating and normalizing one row in place ( sets row.error on failure )
+//
+inline void validateImportRow(ImportRow &row)
+{
+    if (!row.error.empty())
+        return;
+
+    row.title = trimCopy(row.title);
+    row.image_url = trimCopy(row.image_url);
+
+    if (row.title.empty())
+        row.error = "missing title";
+    else if (row.title.size() > kImportMaxTitle)
+        row.error = "title too long";
+    else if (row.image_url.size() > kImportMaxImageUrl)
+        row.error = "image_url too long";
+    else if (!row.image_url.empty() && row.image_url.rfind("http://", 0) != 0 && row.image_url.rfind("https://", 0) != 0)
+        row.error = "image_url must be http(s)";
+    else if (row.summary.size() > kImportMaxSummary)
+        row.error = "summary too long";
+    else if (!isValidUtf8(row.title) || !isValidUtf8(row.summary) || !isValidUtf8(row.image_url))
+        row.error = "invalid UTF-8";
+}
+
+// validating a batch, split across the available cores
+//
+inline void validateBatch(std::vector<ImportRow> &batch)
+{
+    size_t workers = std::max(1u, std::thread::hardware_concurrency());
+    workers = std::min(workers, std::max<size_t>(1, batch.size() / 1024));
+
+    if (workers <= 1)
+    {
+        for (auto &row : batch)
+            validateImportRow(row);
+        return;
+    }
+
+    std::vector<std::thread> threads;
+    size_t chunk = (batch.size() + workers - 1) / workers;
+    for (size_t w = 0; w < workers; ++w)
+    {
+        size_t begin = w * chunk;
+        size_t end = std::min(batch.size(), begin + chunk);
+        threads.emplace_back([&batch, begin, end]()
+                             {
+            for (size_t i = begin; i < end; ++i)
+                validateImportRow(batch[i]); });
+    }
+    for (auto &t : threads)
+        t.join();
+}
+
+// reading one RFC 4180 CSV record ( quoted fields may span lines )
+// returns false at end of input; sets tooLong and stops reading once the
+// record passes kImportMaxRecord bytes ( the rest of the input is not usable )
+//
+inline bool readCsvRecord(std::streambuf *in, std::vector<std::string> &fields, size_t &line, bool &tooLong)
+{
+    fields.clear();
+    std::string field;
+    bool inQuotes = false;
+    size_t bytes = 0;
+    tooLong = false;
+
+    for (;;)
+    {
+        int c = in->sbumpc();
+        if (c == std::char_traits<char>::eof())
+        {
+            if (bytes == 0)
+                return false;
+            fields.push_back(std::move(field));
+            return true;
+        }
+        if (++bytes > kImportMaxRecord)
+        {
+            tooLong = true;
+            return true;
+        }
+
+        if (inQuotes)
+        {
+            if (c == '"')
+            {
+                if (in->sgetc() == '"')
+                {
+                    in->sbumpc();
+                    field += '"';
+                }
+                else
+                {
+                    inQuotes = false;
+                }
+            }
+            else
+            {
+                if (c == '\n')
+                    ++line;
+                field += static_cast<char>(c);
+            }
+        }
+        else if (c == '"')
+        {
+            inQuotes = true;
+        }
+        else if (c == ',')
+        {
+            fields.push_back(std::move(field));
+            field.clear();
+        }
+        else if (c == '\r' || c == '\n')
+        {
+            if (c == '\r' && in->sgetc() == '\n')
+                in->sbumpc();
+            ++line;
+            fields.push_back(std::move(field));
+            return true;
+        }
+        else
+        {
+            field += static_cast<char>(c);
+        }
+    }
+}
+
+// reading one line without its '\n', returns false at end of input
+//
+// a line longer than kImportMaxRecord is consumed to its end but not kept;
+// tooLong tells so and the next line is read normally
+inline bool readBoundedLine(std::streambuf *in, std::string &text, bool &tooLong)
+{
+    text.clear();
+    tooLong = false;
+    bool sawAnything = false;
+    for (;;)
+    {
+        int c = in->sbumpc();
+        if (c == std::char_traits<char>::eof())
+            return sawAnything;
+        sawAnything = true;
+        if (c == '\n')
+            return true;
+        if (tooLong)
+            continue;
+        if (text.size() == kImportMaxRecord)
+        {
+            tooLong = true;
+            text.clear();
+            continue;
+        }
+        text += static_cast<char>(c);
+    }
+}
+
+// read-only streambuf over an existing string ( avoids copying request bodies )
+//
+class MemoryStreamBuf : public std::streambuf
+{
+public:
+    explicit MemoryStreamBuf(const std::string &data)
+    {
+        char *begin = const_cast<char *>(data.data());
+        setg(begin, begin, begin + data.size());
+    }
+};
+
+// streaming reader producing ImportRows in batches
+//
+class ImportReader
+{
+public:
+    ImportReader(std::istream &in, ImportFormat format) : in_(in), format_(format) {}
+
+    // reading up to max rows into batch, returns false once input is exhausted
+    //
+    bool next(std::vector<ImportRow> &batch, size_t max)
+    {
+        batch.clear();
+        if (format_ == ImportFormat::CSV && !headerRead_)
+        {
+            readHeader();
+        }
+
+        while (batch.size() < max)
+        {
+            ImportRow row;
+            bool more = format_ == ImportFormat::CSV ? nextCsv(row) : nextNdjson(row);
+            if (!more)
+                break;
+            batch.push_back(std::move(row));
+        }
+        return !batch.empty();
+    }
+
+    // why reading stopped before the end of the input, empty when it did not
+    const std::string &error() const { return error_; }
+
+private:
+    void readHeader()
+    {
+        headerRead_ = true;
+        std::vector<std::string> fields;
+        bool tooLong = false;
+        if (!readCsvRecord(in_.rdbuf(), fields, line_, tooLong))
+            return;
+        if (tooLong)
+        {
+            error_ = "CSV header longer than " + std::to_string(kImportMaxRecord) + " bytes";
+            return;
+        }
+
+        for (size_t i = 0; i < fields.size(); ++i)
+        {
+            std::string name = trimCopy(fields[i]);
+            if (i == 0 && name.rfind("\xEF\xBB\xBF", 0) == 0)
+                name.erase(0, 3); // UTF-8 BOM
+            std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+            if (name == "title")
+                titleCol_ = static_cast<int>(i);
+            else if (name == "image_url" || name == "image")
+                imageCol_ = static_cast<int>(i);
+            else if (name == "summary")
+                summaryCol_ = static_cast<int>(i);
+        }
+        if (titleCol_ < 0)
+            error_ = "CSV header must contain a title column";
+    }
+
+    bool nextCsv(ImportRow &row)
+    {
+        if (!error_.empty())
+            return false;
+
+        std::vector<std::string> &fields = fields_;
+        bool tooLong = false;
+        do
+        {
+            row.line = line_ + 1;
+            if (!readCsvRecord(in_.rdbuf(), fields, line_, tooLong))
+                return false;
+        } while (!tooLong && fields.size() == 1 && fields[0].empty()); // blank line
+
+        if (tooLong)
+        {
+            // inside an unterminated quote there is no telling where the next record starts
+            error_ = "line " + std::to_string(row.line) + ": record longer than " + std::to_string(kImportMaxRecord) +
+                     " bytes ( unterminated quote? ), import stopped";
+            return false;
+        }
+
+        auto column = [&fields](int col) -> std::string
+        {
+            return col >= 0 && col < static_cast<int>(fields.size()) ? std::move(fields[col]) : std::string();
+        };
+        row.title = column(titleCol_);
+        row.image_url = column(imageCol_);
+        row.summary = column(summaryCol_);
+        return true;
+    }
+
+    bool nextNdjson(ImportRow &row)
+    {
+        std::string &text = text_;
+        bool tooLong = false;
+        do
+        {
+            if (!readBoundedLine(in_.rdbuf(), text, tooLong))
+                return false;
+            ++line_;
+        } while (!tooLong && trimCopy(text).empty());
+
+        row.line = line_;
+        if (tooLong)
+        {
+            row.error = "line longer than " + std::to_string(kImportMaxRecord) + " bytes";
+            return true;
+        }
+        try
+        {
+            auto obj = crow::json::load(text);
+            if (!obj || obj.t() != crow::json::type::Object)
+            {
+                row.error = "invalid JSON object";
+                return true;
+            }
+            if (obj.has("title"))
+                row.title = obj["title"].s();
+            if (obj.has("image_url"))
+                row.image_url = obj["image_url"].s();
+            else if (obj.has("image"))
+                row.image_url = obj["image"].s();
+            if (obj.has("summary"))
+                row.summary = obj["summary"].s();
+        }
+        catch (const std::exception &)
+        {
+            row.error = "fields must be strings";
+        }
+        return true;
+    }
+
+    std::istream &in_;
+    ImportFormat format_;
+    size_t line_ = 0;
+    bool headerRead_ = false;
+    std::string error_;
+    std::vector<std::string> fields_;
+    std::string text_;
+    int titleCol_ = -1, imageCol_ = -1, summaryCol_ = -1;
+};
+
+inline void execPragma(sqlite3 *db, const std::string &sql)
+{
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "import: " << sql << " failed: " << (errMsg ? errMsg : "?") << std::endl;
+        sqlite3_free(errMsg);
+    }
+}
+
+// importing books from a stream into the database
+//
+// the database serves traffic while it loads, so its journal and sync
+// settings are left alone ( a crash mid-batch must not corrupt it ); the
+// speed comes from one big transaction per batch and a larger page cache on
+// this connection. a batch that cannot start its transaction stops the
+// import. catalog listeners are notified once at the end.
+//
+inline ImportStats importBooks(const char *dbName, std::istream &in, ImportFormat format, size_t batchSize = 20000)
+{
+    ImportStats stats;
+    auto started = std::chrono::steady_clock::now();
+
+    sqlite3 *db;
+    if (sqlite3_open(dbName, &db) != SQLITE_OK)
+    {
+        stats.errors.push_back(std::string("cannot open database: ") + sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return stats;
+    }
+    sqlite3_busy_timeout(db, 5000);
+
+    // connection-local tuning only
+    execPragma(db, "PRAGMA cache_size = -65536;");
+    execPragma(db, "PRAGMA temp_store = MEMORY;");
+
+    sqlite3_stmt *stmt = nullptr;
+    const char *sql = "INSERT INTO books (title, image_url, summary) VALUES (?, ?, ?);";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        stats.errors.push_back(std::string("failed to prepare insert: ") + sqlite3_errmsg(db));
+        sqlite3_close(db);
+        return stats;
+    }
+
+    ImportReader reader(in, format);
+    std::vector<ImportRow> batch;
+    batch.reserve(batchSize);
+
+    while (reader.next(batch, batchSize))
+    {
+        stats.parsed += batch.size();
+        validateBatch(batch);
+
+        int rc = SQLITE_BUSY;
+        for (int attempt = 0; attempt < kImportBeginAttempts && (rc == SQLITE_BUSY || rc == SQLITE_LOCKED); ++attempt)
+            rc = sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, nullptr, nullptr);
+        if (rc != SQLITE_OK)
+        {
+            // without the transaction every row would commit on its own; nothing of this batch is written
+            stats.rejected += batch.size();
+            stats.errors.push_back("line " + std::to_string(batch.front().line) + ": import stopped, cannot begin batch: " + sqlite3_errmsg(db));
+            break;
+        }
+
+        size_t insertedInBatch = 0;
+        for (auto &row : batch)
+        {
+            if (row.error.empty())
+            {
+                sqlite3_bind_text(stmt, 1, row.title.c_str(), static_cast<int>(row.title.size()), SQLITE_STATIC);
+                if (row.image_url.empty())
+                    sqlite3_bind_null(stmt, 2);
+                else
+                    sqlite3_bind_text(stmt, 2, row.image_url.c_str(), static_cast<int>(row.image_url.size()), SQLITE_STATIC);
+                sqlite3_bind_text(stmt, 3, row.summary.c_str(), static_cast<int>(row.summary.size()), SQLITE_STATIC);
+
+                if (sqlite3_step(stmt) == SQLITE_DONE)
+                    ++insertedInBatch;
+                else
+                    row.error = sqlite3_errmsg(db);
+                sqlite3_reset(stmt);
+            }
+
+            if (!row.error.empty())
+            {
+                ++stats.rejected;
+                if (stats.errors.size() < kImportMaxErrors)
+                    stats.errors.push_back("line " + std::to_string(row.line) + ": " + row.error);
+            }
+        }
+
+        if (sqlite3_exec(db, "COMMIT;", nullptr, nullptr, nullptr) == SQLITE_OK)
+        {
+            stats.inserted += insertedInBatch;
+        }
+        else
+        {
+            execPragma(db, "ROLLBACK;");
+            stats.rejected += insertedInBatch;
+            stats.errors.push_back(std::string("batch commit failed: ") + sqlite3_errmsg(db));
+        }
+    }
+
+    if (!reader.error().empty())
+        stats.errors.push_back(reader.error());
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+
+    if (stats.inserted > 0)
+        catalog::notifyBooksChanged();
+
+    return stats;
+}
+
+inline crow::json::wvalue importStatsToJson(const ImportStats &stats)
+{
+    crow::json::wvalue out;
+    out["parsed"] = stats.parsed;
+    out["inserted"] = stats.inserted;
+    out["rejected"] = stats.rejected;
+    out["seconds"] = stats.seconds;
+    out["rows_per_second"] = stats.rowsPerSecond();
+    out["errors"] = stats.errors;
+    return out;
+}
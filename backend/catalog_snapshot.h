@@ -0,0 +1,328 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <zlib.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include "change_log.h"
+#include "review_timestamps.h"
+
+// offline catalog bundle for /snapshot
+//
+// a small sqlite file with just what a fresh client needs to start:
+//   books ( id, title, image_url, summary )
+//   book_stats ( book_id, reviews, average )
+//   snapshot_meta ( key, value ): version, created_at, format
+// gzipped as a whole. version is the change log seq it was taken at, so a
+// client continues with /sync?since=version.
+//
+// the live database is first copied to a private file with sqlite3_backup, a
+// few pages per step so writers are never locked out for long ( in wal mode
+// the copy reads one consistent snapshot and does not block them at all ).
+// the bundle is then built from that copy, which is deleted right after since
+// it holds users and their password hashes too.
+//
+// a background thread rebuilds it when the catalog moved on, and retries a
+// failed build after a short backoff; the current bundle is kept in memory
+// and also written to disk.
+
+constexpr int kSnapshotFormat = 1;
+constexpr int kSnapshotBackupPages = 256;                   // pages copied per backup step
+constexpr std::chrono::milliseconds kSnapshotBackupPause{5}; // between steps, writers go first
+constexpr std::chrono::seconds kSnapshotRetry{5};            // first retry after a failed build, doubling
+
+struct CatalogSnapshot
+{
+    int64_t version;
+    int64_t createdAt;
+    std::string etag;
+    std::string bytes; // gzip of the sqlite file
+};
+
+inline bool gzipBytes(const std::string &in, std::string &out)
+{
+    z_stream stream{};
+    // 15 window bits + 16 selects the gzip wrapper
+    if (deflateInit2(&stream, 9, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+        return false;
+
+    out.resize(deflateBound(&stream, in.size()));
+    stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.data()));
+    stream.avail_in = static_cast<uInt>(in.size());
+    stream.next_out = reinterpret_cast<Bytef *>(&out[0]);
+    stream.avail_out = static_cast<uInt>(out.size());
+    int rc = deflate(&stream, Z_FINISH);
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return rc == Z_STREAM_END;
+}
+
+class CatalogSnapshotter
+{
+public:
+    explicit CatalogSnapshotter(std::string path) : path_(std::move(path)) {}
+
+    ~CatalogSnapshotter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    // building now and then every `interval`, when the catalog changed since
+    //
+    void start(const char *dbName, std::chrono::seconds interval)
+    {
+        worker_ = std::thread([this, db = std::string(dbName), interval]()
+                              {
+            std::chrono::seconds retry = kSnapshotRetry;
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stopping_)
+            {
+                lock.unlock();
+                bool ok = refresh(db);
+                lock.lock();
+                wake_.wait_for(lock, ok ? interval : std::min(retry, interval), [this]()
+                               { return stopping_; });
+                retry = ok ? kSnapshotRetry : std::min(retry * 2, interval);
+            } });
+    }
+
+    // the current bundle, null until the first one is built
+    //
+    std::shared_ptr<const CatalogSnapshot> current() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return current_;
+    }
+
+private:
+    // false when a bundle was due and could not be built
+    bool refresh(const std::string &dbName)
+    {
+        auto previous = current();
+        if (previous)
+        {
+            sqlite3 *db;
+            if (sqlite3_open_v2(dbName.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+            {
+                sqlite3_close(db);
+                return false;
+            }
+            sqlite3_busy_timeout(db, 5000);
+            int64_t version = queryInt64(db, "SELECT COALESCE(MAX(seq), 0) FROM changes;");
+            sqlite3_close(db);
+            if (version == previous->version)
+                return true;
+        }
+
+        auto snapshot = std::make_shared<CatalogSnapshot>();
+        if (!build(dbName, *snapshot))
+        {
+            std::cerr << "snapshot: build failed" << std::endl;
+            return false;
+        }
+
+        // the disk copy is for inspection and outside mirrors, requests are served from memory
+        std::string tmp = path_ + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::binary | std::ios::trunc);
+            out.write(snapshot->bytes.data(), static_cast<std::streamsize>(snapshot->bytes.size()));
+        }
+        if (std::rename(tmp.c_str(), path_.c_str()) != 0)
+            std::remove(tmp.c_str());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        current_ = std::move(snapshot);
+        return true;
+    }
+
+    // copying the live database to `copy` in small steps
+    //
+    static bool backupTo(const std::string &dbName, const std::string &copy)
+    {
+        sqlite3 *src;
+        if (sqlite3_open_v2(dbName.c_str(), &src, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(src);
+            return false;
+        }
+        sqlite3_busy_timeout(src, 5000);
+
+        sqlite3 *dst;
+        if (sqlite3_open(copy.c_str(), &dst) != SQLITE_OK)
+        {
+            sqlite3_close(dst);
+            sqlite3_close(src);
+            return false;
+        }
+
+        // in wal mode an open read transaction pins one snapshot for every step without
+        // blocking writers; otherwise each step locks on its own and a write in between
+        // restarts the copy
+        bool pinned = false;
+        sqlite3_stmt *mode = nullptr;
+        if (sqlite3_prepare_v2(src, "PRAGMA journal_mode;", -1, &mode, nullptr) == SQLITE_OK && sqlite3_step(mode) == SQLITE_ROW)
+        {
+            const char *name = reinterpret_cast<const char *>(sqlite3_column_text(mode, 0));
+            pinned = name && std::string(name) == "wal";
+        }
+        sqlite3_finalize(mode);
+        if (pinned)
+            pinned = sqlite3_exec(src, "BEGIN; SELECT COUNT(*) FROM sqlite_master;", nullptr, 0, nullptr) == SQLITE_OK;
+
+        bool ok = false;
+        sqlite3_backup *backup = sqlite3_backup_init(dst, "main", src, "main");
+        if (backup)
+        {
+            int rc;
+            while ((rc = sqlite3_backup_step(backup, kSnapshotBackupPages)) == SQLITE_OK || rc == SQLITE_BUSY || rc == SQLITE_LOCKED)
+            {
+                std::this_thread::sleep_for(rc == SQLITE_OK ? kSnapshotBackupPause : kSnapshotBackupPause * 10);
+            }
+            ok = sqlite3_backup_finish(backup) == SQLITE_OK && rc == SQLITE_DONE;
+        }
+        if (pinned)
+            sqlite3_exec(src, "COMMIT;", nullptr, 0, nullptr);
+        sqlite3_close(dst);
+        sqlite3_close(src);
+        return ok;
+    }
+
+    bool build(const std::string &dbName, CatalogSnapshot &snapshot)
+    {
+        std::string copy = path_ + ".copy.tmp";
+        std::string file = path_ + ".sqlite.tmp";
+        std::remove(copy.c_str());
+        std::remove(file.c_str());
+        if (!backupTo(dbName, copy))
+        {
+            std::remove(copy.c_str());
+            return false;
+        }
+
+        sqlite3 *db;
+        if (sqlite3_open(file.c_str(), &db) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            std::remove(copy.c_str());
+            return false;
+        }
+
+        // the copy is private, nothing else waits on its locks
+        sqlite3_stmt *attach = nullptr;
+        bool ok = sqlite3_exec(db, "PRAGMA journal_mode = OFF; PRAGMA synchronous = OFF;", nullptr, 0, nullptr) == SQLITE_OK &&
+                  sqlite3_prepare_v2(db, "ATTACH DATABASE ? AS src;", -1, &attach, nullptr) == SQLITE_OK &&
+                  sqlite3_bind_text(attach, 1, copy.c_str(), -1, SQLITE_TRANSIENT) == SQLITE_OK &&
+                  sqlite3_step(attach) == SQLITE_DONE;
+        sqlite3_finalize(attach);
+
+        std::string sql = R"(
+            BEGIN;
+            CREATE TABLE books (id INTEGER PRIMARY KEY, title TEXT NOT NULL, image_url TEXT, summary TEXT);
+            INSERT INTO books SELECT id, title, image_url, summary FROM src.books ORDER BY id;
+            CREATE TABLE book_stats (book_id INTEGER PRIMARY KEY, reviews INTEGER NOT NULL, average REAL NOT NULL);
+            INSERT INTO book_stats SELECT book_id, COUNT(*), AVG(rating) FROM src.reviews GROUP BY book_id ORDER BY book_id;
+            CREATE TABLE snapshot_meta (key TEXT PRIMARY KEY, value INTEGER NOT NULL);
+            INSERT INTO snapshot_meta VALUES ('version', (SELECT COALESCE(MAX(seq), 0) FROM src.changes));
+            INSERT INTO snapshot_meta VALUES ('created_at', CAST(strftime('%s', 'now') AS INTEGER));
+            INSERT INTO snapshot_meta VALUES ('format', )" +
+                          std::to_string(kSnapshotFormat) + R"();
+            COMMIT;
+        )";
+        ok = ok && sqlite3_exec(db, sql.c_str(), nullptr, 0, nullptr) == SQLITE_OK;
+        if (ok)
+        {
+            snapshot.version = queryInt64(db, "SELECT value FROM snapshot_meta WHERE key = 'version';");
+            snapshot.createdAt = queryInt64(db, "SELECT value FROM snapshot_meta WHERE key = 'created_at';");
+        }
+        sqlite3_exec(db, "DETACH DATABASE src;", nullptr, 0, nullptr);
+        sqlite3_close(db);
+        std::remove(copy.c_str());
+
+        std::string raw;
+        if (ok)
+        {
+            std::ifstream in(file, std::ios::binary);
+            raw.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+            ok = !raw.empty() && gzipBytes(raw, snapshot.bytes);
+        }
+        std::remove(file.c_str());
+        if (ok)
+            snapshot.etag = "\"v" + std::to_string(snapshot.version) + "-" + std::to_string(snapshot.createdAt) + "\"";
+        return ok;
+    }
+
+    std::string path_;
+    mutable std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::shared_ptr<const CatalogSnapshot> current_;
+    std::thread worker_;
+};
+
+// one byte range from a Range header against a body of `size` bytes
+//
+enum class RangeResult
+{
+    None,       // no usable range, send everything
+    Partial,    // send [first, last]
+    Unsatisfiable
+};
+
+inline RangeResult parseByteRange(const std::string &header, size_t size, size_t &first, size_t &last)
+{
+    const std::string prefix = "bytes=";
+    if (header.compare(0, prefix.size(), prefix) != 0 || header.find(',') != std::string::npos)
+        return RangeResult::None; // other units and multiple ranges may be ignored
+    std::string spec = header.substr(prefix.size());
+    size_t dash = spec.find('-');
+    if (dash == std::string::npos)
+        return RangeResult::None;
+
+    std::string from = spec.substr(0, dash), to = spec.substr(dash + 1);
+    char *end = nullptr;
+    if (from.empty())
+    {
+        // suffix range: the last N bytes
+        unsigned long long count = std::strtoull(to.c_str(), &end, 10);
+        if (to.empty() || *end != '\0')
+            return RangeResult::None;
+        if (count == 0 || size == 0)
+            return RangeResult::Unsatisfiable;
+        first = count >= size ? 0 : size - static_cast<size_t>(count);
+        last = size - 1;
+        return RangeResult::Partial;
+    }
+
+    unsigned long long start = std::strtoull(from.c_str(), &end, 10);
+    if (*end != '\0')
+        return RangeResult::None;
+    unsigned long long stop = size ? size - 1 : 0;
+    if (!to.empty())
+    {
+        stop = std::strtoull(to.c_str(), &end, 10);
+        if (*end != '\0' || stop < start)
+            return RangeResult::None;
+    }
+    if (start >= size)
+        return RangeResult::Unsatisfiable;
+    first = static_cast<size_t>(start);
+    last = static_cast<size_t>(std::min<unsigned long long>(stop, size - 1));
+    return RangeResult::Partial;
+}
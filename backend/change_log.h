@@ -0,0 +1,276 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "review_timestamps.h"
+
+// change log for delta sync ( /sync?since=V )
+//
+// triggers on books and reviews append one row per insert, update and delete
+// to `changes`, inside the writing transaction, so the log can never
+// disagree with the tables. seq is AUTOINCREMENT: strictly increasing and
+// never reused, and it is the version handed to clients. rows older than the
+// retention window are pruned in the background; a client whose version is
+// older than what was pruned gets a full snapshot instead of deltas.
+
+constexpr int64_t kChangeRetentionSeconds = 7 * 24 * 3600;
+constexpr int64_t kSyncMaxChanges = 20000; // more raw changes than this and a snapshot is cheaper
+
+inline bool ensureChangeLogSchema(sqlite3 *db)
+{
+    const char *sql = R"(
+        CREATE TABLE IF NOT EXISTS changes (
+            seq INTEGER PRIMARY KEY AUTOINCREMENT,
+            entity TEXT NOT NULL,
+            entity_id INTEGER NOT NULL,
+            op TEXT NOT NULL,
+            at INTEGER NOT NULL
+        );
+
+        CREATE TABLE IF NOT EXISTS sync_state (
+            key TEXT PRIMARY KEY,
+            value INTEGER NOT NULL
+        );
+        INSERT OR IGNORE INTO sync_state (key, value) VALUES ('pruned_through', 0);
+
+        CREATE TRIGGER IF NOT EXISTS books_changes_ai AFTER INSERT ON books BEGIN
+            INSERT INTO changes (entity, entity_id, op, at) VALUES ('book', new.id, 'upsert', strftime('%s', 'now'));
+        END;
+        CREATE TRIGGER IF NOT EXISTS books_changes_au AFTER UPDATE ON books BEGIN
+            INSERT INTO changes (entity, entity_id, op, at) VALUES ('book', new.id, 'upsert', strftime('%s', 'now'));
+        END;
+        CREATE TRIGGER IF NOT EXISTS books_changes_ad AFTER DELETE ON books BEGIN
+            INSERT INTO changes (entity, entity_id, op, at) VALUES ('book', old.id, 'delete', strftime('%s', 'now'));
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS reviews_changes_ai AFTER INSERT ON reviews BEGIN
+            INSERT INTO changes (entity, entity_id, op, at) VALUES ('review', new.id, 'upsert', strftime('%s', 'now'));
+        END;
+        CREATE TRIGGER IF NOT EXISTS reviews_changes_au AFTER UPDATE OF user_id, book_id, rating, comment ON reviews BEGIN
+            INSERT INTO changes (entity, entity_id, op, at) VALUES ('review', new.id, 'upsert', strftime('%s', 'now'));
+        END;
+        CREATE TRIGGER IF NOT EXISTS reviews_changes_ad AFTER DELETE ON reviews BEGIN
+            INSERT INTO changes (entity, entity_id, op, at) VALUES ('review', old.id, 'delete', strftime('%s', 'now'));
+        END;
+    )";
+
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, sql, nullptr, 0, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "failed to create change log: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+inline int64_t queryInt64(sqlite3 *db, const char *sql, int64_t bind = 0)
+{
+    sqlite3_stmt *stmt = nullptr;
+    int64_t value = 0;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        if (sqlite3_bind_parameter_count(stmt) > 0)
+            sqlite3_bind_int64(stmt, 1, bind);
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+            value = sqlite3_column_int64(stmt, 0);
+    }
+    sqlite3_finalize(stmt);
+    return value;
+}
+
+template <class Writer>
+void writeSyncBook(sqlite3_stmt *stmt, Writer &out)
+{
+    out.beginObject(4);
+    out.key("id");
+    out.integer(sqlite3_column_int64(stmt, 0));
+    const char *names[] = {"title", "image", "summary"};
+    for (int column = 1; column <= 3; ++column)
+    {
+        const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+        out.key(names[column - 1]);
+        out.string(text ? text : "", text ? static_cast<size_t>(sqlite3_column_bytes(stmt, column)) : 0);
+    }
+    out.endObject();
+}
+
+template <class Writer>
+void writeSyncReview(sqlite3_stmt *stmt, Writer &out)
+{
+    out.beginObject(7);
+    out.key("id");
+    out.integer(sqlite3_column_int64(stmt, 0));
+    out.key("book_id");
+    out.integer(sqlite3_column_int64(stmt, 1));
+    out.key("rating");
+    out.integer(sqlite3_column_int64(stmt, 2));
+    const char *comment = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 3));
+    out.key("comment");
+    out.string(comment ? comment : "", comment ? static_cast<size_t>(sqlite3_column_bytes(stmt, 3)) : 0);
+    const char *username = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 4));
+    out.key("username");
+    out.string(username ? username : "", username ? static_cast<size_t>(sqlite3_column_bytes(stmt, 4)) : 0);
+    out.key("created_at");
+    out.integer(sqlite3_column_int64(stmt, 5));
+    out.key("updated_at");
+    out.integer(sqlite3_column_int64(stmt, 6));
+    out.endObject();
+}
+
+// writing every row of a query through a row writer, as an array
+template <class Writer, class WriteRow>
+bool writeSyncRows(sqlite3 *db, const std::string &sql, int64_t since, Writer &out, WriteRow writeRow)
+{
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+        return false;
+    if (sqlite3_bind_parameter_count(stmt) > 0)
+        sqlite3_bind_int64(stmt, 1, since);
+
+    int rc;
+    out.beginArray();
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        writeRow(stmt, out);
+    out.endArray();
+    sqlite3_finalize(stmt);
+    return rc == SQLITE_DONE;
+}
+
+// one entity's section: { "upserts": [ rows ], "deletes": [ ids ] }
+template <class Writer, class WriteRow>
+bool writeSyncSection(sqlite3 *db, const char *entity, const std::string &rowsSql, bool full, int64_t since, Writer &out, WriteRow writeRow)
+{
+    out.beginObject(2);
+    out.key("upserts");
+    // compacted: only the last change per row counts, and upserts carry the current row
+    std::string changed = std::string("SELECT entity_id FROM (SELECT entity_id, op, MAX(seq) FROM changes WHERE seq > ?1 AND entity = '") +
+                          entity + "' GROUP BY entity_id) WHERE op = ";
+    if (!writeSyncRows(db, full ? rowsSql + ";" : rowsSql + " WHERE x.id IN (" + changed + "'upsert');", since, out, writeRow))
+        return false;
+
+    out.key("deletes");
+    if (full)
+    {
+        out.beginArray();
+        out.endArray();
+    }
+    else if (!writeSyncRows(db, changed + "'delete';", since, out, [](sqlite3_stmt *stmt, Writer &w)
+                            { w.integer(sqlite3_column_int64(stmt, 0)); }))
+        return false;
+    out.endObject();
+    return true;
+}
+
+// the sync document for a client at version `since`, inside the caller's read transaction
+//
+// { "version": V, "full": bool, "books": section, "reviews": section }, a full
+// document lists every row and no deletes, and replaces what the client has
+template <class Writer>
+bool writeSync(sqlite3 *db, int64_t since, Writer &out)
+{
+    int64_t version = queryInt64(db, "SELECT COALESCE(MAX(seq), 0) FROM changes;");
+    int64_t prunedThrough = queryInt64(db, "SELECT value FROM sync_state WHERE key = 'pruned_through';");
+    bool full = since <= 0 || since < prunedThrough || since > version ||
+                queryInt64(db, "SELECT COUNT(*) FROM changes WHERE seq > ?;", since) > kSyncMaxChanges;
+
+    out.beginObject(4);
+    out.key("version");
+    out.integer(version);
+    out.key("full");
+    out.boolean(full);
+    out.key("books");
+    if (!writeSyncSection(db, "book", "SELECT x.id, x.title, x.image_url, x.summary FROM books x", full, since, out, writeSyncBook<Writer>))
+        return false;
+    out.key("reviews");
+    if (!writeSyncSection(db, "review", "SELECT x.id, x.book_id, x.rating, x.comment, u.username, COALESCE(x.created_at, 0), COALESCE(x.updated_at, 0) FROM reviews x JOIN users u ON u.id = x.user_id", full, since, out, writeSyncReview<Writer>))
+        return false;
+    out.endObject();
+    return true;
+}
+
+// background pruning of changes older than the retention window
+//
+class ChangeLogPruner
+{
+public:
+    ~ChangeLogPruner()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    void start(const char *dbName, std::chrono::seconds interval)
+    {
+        worker_ = std::thread([this, db = std::string(dbName), interval]()
+                              {
+            std::unique_lock<std::mutex> lock(mutex_);
+            while (!stopping_)
+            {
+                lock.unlock();
+                prune(db);
+                lock.lock();
+                wake_.wait_for(lock, interval, [this]()
+                               { return stopping_; });
+            } });
+    }
+
+private:
+    static void prune(const std::string &dbName)
+    {
+        sqlite3 *db;
+        if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        // pruned_through moves in the same transaction as the delete
+        if (sqlite3_exec(db, "BEGIN IMMEDIATE;", nullptr, 0, nullptr) == SQLITE_OK)
+        {
+            int64_t through = queryInt64(db, "SELECT COALESCE(MAX(seq), 0) FROM changes WHERE at < ?;", unixNow() - kChangeRetentionSeconds);
+            bool ok = true;
+            if (through > 0)
+            {
+                sqlite3_stmt *stmt = nullptr;
+                ok = sqlite3_prepare_v2(db, "DELETE FROM changes WHERE seq <= ?;", -1, &stmt, nullptr) == SQLITE_OK;
+                if (ok)
+                {
+                    sqlite3_bind_int64(stmt, 1, through);
+                    ok = sqlite3_step(stmt) == SQLITE_DONE;
+                }
+                sqlite3_finalize(stmt);
+                if (ok)
+                {
+                    ok = sqlite3_prepare_v2(db, "UPDATE sync_state SET value = MAX(value, ?) WHERE key = 'pruned_through';", -1, &stmt, nullptr) == SQLITE_OK;
+                    if (ok)
+                    {
+                        sqlite3_bind_int64(stmt, 1, through);
+                        ok = sqlite3_step(stmt) == SQLITE_DONE;
+                    }
+                    sqlite3_finalize(stmt);
+                }
+            }
+            sqlite3_exec(db, ok ? "COMMIT;" : "ROLLBACK;", nullptr, 0, nullptr);
+        }
+        sqlite3_close(db);
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread worker_;
+};
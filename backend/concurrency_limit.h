@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include "metrics.h"
+
+// adaptive per route concurrency limits ( AIMD on latency )
+//
+// a route admits at most `limit` requests at once and sheds the rest with a
+// 503 straight away, before any sqlite or bcrypt work. the limit grows by one
+// for each request that finished within the latency target while the route
+// was at least half busy, and shrinks by 10% ( at most once per target
+// interval, so one burst of slow responses counts once ) when a request took
+// longer. requests are admitted before they queue for their lane and
+// measured until their response is written, so time spent in the lane's
+// queue, on sqlite locks or on the cpu all shows up as latency and the limit
+// settles where queueing stays under the target.
+//
+// requests may carry their own time budget; when the route's recent latency
+// already exceeds it the answer would arrive after the client gave up, and
+// the request is shed as well.
+
+class ConcurrencyLimiter
+{
+public:
+    ConcurrencyLimiter(const std::string &route, std::chrono::milliseconds latencyTarget, int initialLimit = 20, int minLimit = 2, int maxLimit = 256)
+        : target_(static_cast<double>(latencyTarget.count())),
+          minLimit_(minLimit), maxLimit_(maxLimit), limit_(initialLimit), limitValue_(initialLimit),
+          limitGauge_(metrics::gauge("concurrency_limit{route=\"" + route + "\"}", "current adaptive concurrency limit per route")),
+          inflightGauge_(metrics::gauge("concurrency_inflight{route=\"" + route + "\"}", "requests being handled per route")),
+          shedOverLimit_(metrics::counter("requests_shed_total{route=\"" + route + "\",reason=\"limit\"}", "requests refused with 503 by the concurrency limiter")),
+          shedOverBudget_(metrics::counter("requests_shed_total{route=\"" + route + "\",reason=\"budget\"}", "requests refused with 503 by the concurrency limiter"))
+    {
+        limitGauge_.set(initialLimit);
+    }
+
+    // one admitted request, released when it goes out of scope
+    class Permit
+    {
+    public:
+        Permit() = default;
+        Permit(ConcurrencyLimiter *owner, int inflight) : owner_(owner), inflight_(inflight), start_(std::chrono::steady_clock::now()) {}
+        Permit(Permit &&other) noexcept : owner_(other.owner_), inflight_(other.inflight_), start_(other.start_) { other.owner_ = nullptr; }
+        Permit(const Permit &) = delete;
+        Permit &operator=(const Permit &) = delete;
+        Permit &operator=(Permit &&) = delete;
+
+        ~Permit()
+        {
+            if (owner_)
+                owner_->release(inflight_, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start_).count());
+        }
+
+        // giving the slot back without a latency sample, for a request admitted but never run
+        void cancel()
+        {
+            if (owner_)
+                owner_->cancel();
+            owner_ = nullptr;
+        }
+
+        explicit operator bool() const { return owner_ != nullptr; }
+
+    private:
+        ConcurrencyLimiter *owner_ = nullptr;
+        int inflight_ = 0;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // admitting a request, or an empty permit when it should be shed
+    //
+    // budgetMs is the client's remaining time, 0 when it did not say
+    Permit tryAcquire(int64_t budgetMs = 0)
+    {
+        if (budgetMs > 0 && smoothedLatency_.load(std::memory_order_relaxed) > budgetMs)
+        {
+            shedOverBudget_.inc();
+            return Permit();
+        }
+
+        int inflight = inflight_.fetch_add(1, std::memory_order_acq_rel) + 1;
+        if (inflight > limit_.load(std::memory_order_relaxed))
+        {
+            inflight_.fetch_sub(1, std::memory_order_acq_rel);
+            shedOverLimit_.inc();
+            return Permit();
+        }
+        inflightGauge_.set(inflight);
+        return Permit(this, inflight);
+    }
+
+    int limit() const { return limit_.load(std::memory_order_relaxed); }
+
+private:
+    void cancel()
+    {
+        inflightGauge_.set(inflight_.fetch_sub(1, std::memory_order_acq_rel) - 1);
+    }
+
+    void release(int inflight, double latencyMs)
+    {
+        inflightGauge_.set(inflight_.fetch_sub(1, std::memory_order_acq_rel) - 1);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        double smoothed = smoothedLatency_.load(std::memory_order_relaxed);
+        smoothedLatency_.store(smoothed == 0 ? latencyMs : smoothed * 0.9 + latencyMs * 0.1, std::memory_order_relaxed);
+
+        auto now = std::chrono::steady_clock::now();
+        if (latencyMs > target_)
+        {
+            if (std::chrono::duration<double, std::milli>(now - lastDecrease_).count() < target_)
+                return;
+            limitValue_ = std::max<double>(minLimit_, limitValue_ * 0.9);
+            lastDecrease_ = now;
+        }
+        else if (inflight * 2 >= limit_.load(std::memory_order_relaxed))
+            limitValue_ = std::min<double>(maxLimit_, limitValue_ + 1);
+        else
+            return;
+
+        limit_.store(static_cast<int>(limitValue_), std::memory_order_relaxed);
+        limitGauge_.set(static_cast<int>(limitValue_));
+    }
+
+    const double target_;
+    const int minLimit_;
+    const int maxLimit_;
+
+    std::atomic<int> inflight_{0};
+    std::atomic<int> limit_;
+    std::atomic<double> smoothedLatency_{0};
+
+    std::mutex mutex_; // guards the fields below, taken on release only
+    double limitValue_;
+    std::chrono::steady_clock::time_point lastDecrease_;
+
+    metrics::Gauge &limitGauge_;
+    metrics::Gauge &inflightGauge_;
+    metrics::Counter &shedOverLimit_;
+    metrics::Counter &shedOverBudget_;
+};
+
+// the limiter for a route, created on first use
+//
+inline ConcurrencyLimiter &routeLimiter(const std::string &route, std::chrono::milliseconds latencyTarget)
+{
+    static std::mutex mutex;
+    static std::map<std::string, std::unique_ptr<ConcurrencyLimiter>> limiters;
+    std::lock_guard<std::mutex> lock(mutex);
+    auto &limiter = limiters[route];
+    if (!limiter)
+        limiter = std::make_unique<ConcurrencyLimiter>(route, latencyTarget);
+    return *limiter;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <chrono>
+
+// request deadlines, enforced inside sqlite
+//
+// a request gets a deadline when it arrives ( the route's default, or sooner
+// when the client asks for it ). while its handler runs, the deadline is the
+// thread's current one and every connection opened through openDB gets a
+// progress handler that aborts the running statement once the deadline has
+// passed; the statement then fails with SQLITE_INTERRUPT as if
+// sqlite3_interrupt had been called, and the handler's error path runs. the
+// caller turns the result into a 504.
+//
+// a client hanging up does not end a request early: crow stops reading a
+// connection while its response is pending, so the hang-up is not seen
+// until the response is written. the deadline bounds that work instead.
+
+constexpr int kDeadlineProgressOps = 1000; // vm instructions between checks
+
+class RequestDeadline
+{
+public:
+    enum class Outcome
+    {
+        Running,
+        TimedOut
+    };
+
+    explicit RequestDeadline(std::chrono::steady_clock::time_point at) : at_(at) {}
+
+    bool passed() const { return std::chrono::steady_clock::now() >= at_; }
+
+    std::chrono::steady_clock::time_point at() const { return at_; }
+
+    // set once a statement was aborted on this request's behalf
+    Outcome outcome() const { return outcome_; }
+
+    // for a request whose time ran out before its handler started
+    void expire() { outcome_ = Outcome::TimedOut; }
+
+    // aborting statements on this connection once the deadline is over
+    //
+    void watch(sqlite3 *db)
+    {
+        sqlite3_progress_handler(db, kDeadlineProgressOps, &RequestDeadline::onProgress, this);
+    }
+
+private:
+    static int onProgress(void *self)
+    {
+        auto *deadline = static_cast<RequestDeadline *>(self);
+        if (std::chrono::steady_clock::now() >= deadline->at_)
+        {
+            deadline->outcome_ = Outcome::TimedOut;
+            return 1;
+        }
+        return 0;
+    }
+
+    std::chrono::steady_clock::time_point at_;
+    Outcome outcome_ = Outcome::Running;
+};
+
+// the deadline of the request this thread is handling, if any
+inline thread_local RequestDeadline *currentDeadline = nullptr;
+
+// making a deadline the thread's current one for a scope
+class ScopedDeadline
+{
+public:
+    explicit ScopedDeadline(RequestDeadline *deadline) : previous_(currentDeadline)
+    {
+        currentDeadline = deadline;
+    }
+
+    ~ScopedDeadline()
+    {
+        currentDeadline = previous_;
+    }
+
+    ScopedDeadline(const ScopedDeadline &) = delete;
+    ScopedDeadline &operator=(const ScopedDeadline &) = delete;
+
+private:
+    RequestDeadline *previous_;
+};
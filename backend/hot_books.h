@@ -0,0 +1,175 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// which books are requested the most
+//
+// a count-min sketch estimates every book's request count in fixed memory
+// ( lock-free increments, the estimate is the smallest of the book's
+// counters and can only overcount ), and the books whose estimate beats the
+// current k-th best are kept in a small top-k list. counts are halved every
+// kHotBooksWindow requests so the list follows current traffic. the list is
+// saved on shutdown; the next start reads it back and warms those books
+// before it takes requests.
+
+constexpr size_t kHotBooksK = 50;
+constexpr uint64_t kHotBooksWindow = 1 << 20;
+
+class CountMinSketch
+{
+public:
+    static constexpr int kDepth = 4;
+    static constexpr size_t kWidth = 4096; // overcount under ~ total / 4096 with high probability
+
+    CountMinSketch() : counters_(new std::atomic<uint32_t>[kDepth * kWidth]()) {}
+
+    // adding one and returning the new estimate
+    //
+    uint32_t add(uint64_t key)
+    {
+        uint32_t estimate = UINT32_MAX;
+        for (int row = 0; row < kDepth; ++row)
+            estimate = std::min(estimate, counters_[slot(row, key)].fetch_add(1, std::memory_order_relaxed) + 1);
+        return estimate;
+    }
+
+    uint32_t estimate(uint64_t key) const
+    {
+        uint32_t estimate = UINT32_MAX;
+        for (int row = 0; row < kDepth; ++row)
+            estimate = std::min(estimate, counters_[slot(row, key)].load(std::memory_order_relaxed));
+        return estimate;
+    }
+
+    // halving every counter; increments racing with it may be lost, which only ages them sooner
+    void halve()
+    {
+        for (size_t i = 0; i < kDepth * kWidth; ++i)
+            counters_[i].store(counters_[i].load(std::memory_order_relaxed) / 2, std::memory_order_relaxed);
+    }
+
+private:
+    static size_t slot(int row, uint64_t key)
+    {
+        // one multiplicative hash per row, seeded by the row
+        uint64_t h = (key + 1) * (0x9e3779b97f4a7c15ULL + 2 * static_cast<uint64_t>(row));
+        h ^= h >> 29;
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 32;
+        return row * kWidth + (h % kWidth);
+    }
+
+    std::unique_ptr<std::atomic<uint32_t>[]> counters_;
+};
+
+class HotBooks
+{
+public:
+    HotBooks()
+    {
+        top_.reserve(kHotBooksK + 1);
+    }
+
+    // counting one request for a book
+    //
+    void record(int bookId)
+    {
+        uint32_t estimate = sketch_.add(static_cast<uint64_t>(bookId));
+        bool age = total_.fetch_add(1, std::memory_order_relaxed) + 1 == kHotBooksWindow;
+        if (estimate <= floor_.load(std::memory_order_relaxed) && !age)
+            return; // not a contender, the common case takes no lock
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (age)
+        {
+            sketch_.halve();
+            for (auto &entry : top_)
+                entry.second /= 2;
+            total_.store(0, std::memory_order_relaxed);
+        }
+        top_[bookId] = std::max(top_[bookId], estimate);
+        if (top_.size() > kHotBooksK)
+        {
+            auto coldest = std::min_element(top_.begin(), top_.end(), [](const auto &a, const auto &b)
+                                            { return a.second < b.second; });
+            top_.erase(coldest);
+        }
+        uint32_t floor = 0;
+        if (top_.size() == kHotBooksK)
+        {
+            floor = UINT32_MAX;
+            for (const auto &entry : top_)
+                floor = std::min(floor, entry.second);
+        }
+        floor_.store(floor, std::memory_order_relaxed);
+    }
+
+    uint32_t estimate(int bookId) const
+    {
+        return sketch_.estimate(static_cast<uint64_t>(bookId));
+    }
+
+    // the heavy hitters, hottest first, as ( book id, estimated requests )
+    //
+    std::vector<std::pair<int, uint32_t>> top() const
+    {
+        std::vector<std::pair<int, uint32_t>> books;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            books.assign(top_.begin(), top_.end());
+        }
+        std::sort(books.begin(), books.end(), [](const auto &a, const auto &b)
+                  { return a.second != b.second ? a.second > b.second : a.first < b.first; });
+        return books;
+    }
+
+    // writing the top list to `path`, one "book_id count" per line
+    //
+    bool save(const std::string &path) const
+    {
+        std::string tmp = path + ".tmp";
+        {
+            std::ofstream out(tmp, std::ios::trunc);
+            for (const auto &book : top())
+                out << book.first << " " << book.second << "\n";
+            if (!out)
+                return false;
+        }
+        return std::rename(tmp.c_str(), path.c_str()) == 0;
+    }
+
+    // the book ids saved by a previous run, hottest first; their counts seed this run's list
+    //
+    std::vector<int> loadSaved(const std::string &path)
+    {
+        std::vector<int> ids;
+        std::ifstream in(path);
+        int bookId;
+        uint32_t count;
+        std::lock_guard<std::mutex> lock(mutex_);
+        while (ids.size() < kHotBooksK && in >> bookId >> count)
+        {
+            ids.push_back(bookId);
+            top_[bookId] = std::max(top_[bookId], count / 2); // a head start, not a lock on the list
+        }
+        return ids;
+    }
+
+private:
+    CountMinSketch sketch_;
+    std::atomic<uint64_t> total_{0};
+    std::atomic<uint32_t> floor_{0}; // the k-th best estimate once the list is full
+
+    mutable std::mutex mutex_;
+    std::unordered_map<int, uint32_t> top_;
+};
@@ -0,0 +1,460 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "catalog_events.h"
+#include "rcu.h"
+
+// "readers also liked"
+//
+// the reviews table is mirrored in memory as a sparse user x book rating
+// matrix, kept current by review change events. the mirror belongs to the
+// background thread: review routes only queue their changes under the lock,
+// and the thread applies them and builds the arrays outside it. a user who
+// reviewed a book more than once counts with the rating of the latest review
+// ( highest id ); deleting it brings back the one before. the thread turns the
+// mirror into CSR ( user -> books ) and CSC ( book -> users ) arrays whose values are
+// pre-divided by each book's norm, so cosine similarity is a plain sparse dot
+// product, and keeps the top K neighbours per book. after the first full
+// build only books touched by new reviews are recomputed, and their new
+// scores are patched into their neighbours' lists ( similarity is symmetric ).
+
+constexpr size_t kSimilarNeighbors = 20;
+constexpr size_t kSimilarMaxUserDegree = 2000; // power users add noise and quadratic cost
+constexpr int kSimilarFullRebuildEvery = 50;   // incremental rounds between full rebuilds
+
+struct SimilarBook
+{
+    int bookId;
+    float similarity;
+};
+
+struct SimilarityModel
+{
+    std::unordered_map<int, std::vector<SimilarBook>> neighbors;
+};
+
+class ItemSimilarity
+{
+public:
+    ItemSimilarity() = default;
+    ItemSimilarity(const ItemSimilarity &) = delete;
+    ItemSimilarity &operator=(const ItemSimilarity &) = delete;
+
+    ~ItemSimilarity()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    // loading the rating matrix and starting the background builder
+    // ( threads = 0: one per core )
+    //
+    bool start(const char *dbName, std::chrono::milliseconds debounce, size_t threads = 0)
+    {
+        sqlite3 *db;
+        if (sqlite3_open_v2(dbName, &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            std::cerr << "similar: cannot open database: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        sqlite3_stmt *stmt = nullptr;
+        int rc = SQLITE_ERROR;
+        // the worker is not running yet, and changes arriving meanwhile wait in pending_
+        if (sqlite3_prepare_v2(db, "SELECT id, user_id, book_id, rating FROM reviews;", -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+                byUser_[sqlite3_column_int(stmt, 1)].push_back(
+                    {sqlite3_column_int(stmt, 2), sqlite3_column_int(stmt, 0), static_cast<float>(sqlite3_column_int(stmt, 3))});
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            fullRebuild_ = true;
+        }
+        threads_ = threads > 0 ? threads : std::max(1u, std::thread::hardware_concurrency());
+        worker_ = std::thread([this, debounce]()
+                              { run(debounce); });
+        return rc == SQLITE_DONE;
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        pending_.push_back({change.kind, change.review_id, change.user_id, change.book_id, static_cast<float>(change.rating)});
+        wake_.notify_one();
+    }
+
+    std::vector<SimilarBook> similar(int bookId, size_t k) const
+    {
+        auto model = model_.read();
+        if (!model)
+            return {};
+        auto it = model->neighbors.find(bookId);
+        if (it == model->neighbors.end())
+            return {};
+        return std::vector<SimilarBook>(it->second.begin(), it->second.begin() + std::min(k, it->second.size()));
+    }
+
+private:
+    // one review in a user's list; a book can appear more than once
+    struct Rating
+    {
+        int bookId;
+        int reviewId;
+        float value;
+    };
+
+    struct Change
+    {
+        catalog::ReviewChange::Kind kind;
+        int reviewId;
+        int userId;
+        int bookId;
+        float value;
+    };
+
+    // compressed matrix built from the maps; book columns are unit length
+    struct Matrix
+    {
+        std::vector<int> bookIds;               // dense book index -> book id
+        std::unordered_map<int, uint32_t> bookIndex;
+        std::vector<uint32_t> colPtr, colUsers; // CSC: book -> users
+        std::vector<float> colValues;
+        std::vector<uint32_t> rowPtr, rowBooks; // CSR: user -> books
+        std::vector<float> rowValues;
+
+        size_t memoryBytes() const
+        {
+            return (colPtr.size() + colUsers.size() + colValues.size() + rowPtr.size() + rowBooks.size() + rowValues.size()) * 4 +
+                   bookIds.size() * (sizeof(int) + 24);
+        }
+    };
+
+    // worker thread only
+    void apply(const Change &change)
+    {
+        auto &list = byUser_[change.userId];
+        auto it = std::find_if(list.begin(), list.end(), [&change](const Rating &r)
+                               { return r.reviewId == change.reviewId; });
+        if (change.kind == catalog::ReviewChange::Kind::Deleted)
+        {
+            if (it != list.end())
+                list.erase(it);
+            if (list.empty())
+                byUser_.erase(change.userId);
+        }
+        else if (it != list.end())
+        {
+            it->value = change.value;
+        }
+        else
+        {
+            list.push_back({change.bookId, change.reviewId, change.value});
+        }
+    }
+
+    // worker thread only; sorts each user's list by ( book, review ) so the
+    // latest review of a book comes last among its duplicates
+    std::unique_ptr<Matrix> buildMatrix()
+    {
+        auto m = std::make_unique<Matrix>();
+        for (auto &entry : byUser_)
+        {
+            std::sort(entry.second.begin(), entry.second.end(), [](const Rating &a, const Rating &b)
+                      { return a.bookId != b.bookId ? a.bookId < b.bookId : a.reviewId < b.reviewId; });
+            for (const auto &r : entry.second)
+                m->bookIds.push_back(r.bookId);
+        }
+        std::sort(m->bookIds.begin(), m->bookIds.end());
+        m->bookIds.erase(std::unique(m->bookIds.begin(), m->bookIds.end()), m->bookIds.end());
+        m->bookIndex.reserve(m->bookIds.size());
+        for (uint32_t i = 0; i < m->bookIds.size(); ++i)
+            m->bookIndex.emplace(m->bookIds[i], i);
+
+        // CSR, one value per ( user, book ): the last of a run of duplicates
+        m->rowPtr.push_back(0);
+        for (const auto &entry : byUser_)
+        {
+            const auto &list = entry.second;
+            size_t start = m->rowBooks.size();
+            for (size_t k = 0; k < list.size(); ++k)
+            {
+                if (k + 1 < list.size() && list[k + 1].bookId == list[k].bookId)
+                    continue;
+                m->rowBooks.push_back(m->bookIndex.at(list[k].bookId));
+                m->rowValues.push_back(list[k].value);
+            }
+            if (m->rowBooks.size() - start > kSimilarMaxUserDegree)
+            {
+                m->rowBooks.resize(start);
+                m->rowValues.resize(start);
+                continue;
+            }
+            m->rowPtr.push_back(static_cast<uint32_t>(m->rowBooks.size()));
+        }
+
+        // CSC as the transpose of CSR
+        size_t users = m->rowPtr.size() - 1;
+        m->colPtr.assign(m->bookIds.size() + 1, 0);
+        for (uint32_t b : m->rowBooks)
+            ++m->colPtr[b + 1];
+        for (size_t b = 0; b < m->bookIds.size(); ++b)
+            m->colPtr[b + 1] += m->colPtr[b];
+        m->colUsers.resize(m->rowBooks.size());
+        m->colValues.resize(m->rowBooks.size());
+        std::vector<uint32_t> fill(m->colPtr.begin(), m->colPtr.end() - 1);
+        for (uint32_t u = 0; u < users; ++u)
+        {
+            for (uint32_t k = m->rowPtr[u]; k < m->rowPtr[u + 1]; ++k)
+            {
+                uint32_t at = fill[m->rowBooks[k]]++;
+                m->colUsers[at] = u;
+                m->colValues[at] = m->rowValues[k];
+            }
+        }
+
+        std::vector<float> invNorm(m->bookIds.size(), 0.0f);
+        for (uint32_t b = 0; b < m->bookIds.size(); ++b)
+        {
+            double norm = 0;
+            for (uint32_t k = m->colPtr[b]; k < m->colPtr[b + 1]; ++k)
+                norm += static_cast<double>(m->colValues[k]) * m->colValues[k];
+            invNorm[b] = norm > 0 ? static_cast<float>(1.0 / std::sqrt(norm)) : 0.0f;
+            for (uint32_t k = m->colPtr[b]; k < m->colPtr[b + 1]; ++k)
+                m->colValues[k] *= invNorm[b];
+        }
+        for (size_t k = 0; k < m->rowBooks.size(); ++k)
+            m->rowValues[k] *= invNorm[m->rowBooks[k]];
+        return m;
+    }
+
+    // cosine scores of book b against every co-rated book, left in acc / touched
+    //
+    static void scoreBook(const Matrix &m, uint32_t b, std::vector<float> &acc, std::vector<uint32_t> &touched)
+    {
+        touched.clear();
+        for (uint32_t k = m.colPtr[b]; k < m.colPtr[b + 1]; ++k)
+        {
+            uint32_t user = m.colUsers[k];
+            float weight = m.colValues[k];
+            const uint32_t *books = m.rowBooks.data() + m.rowPtr[user];
+            const float *values = m.rowValues.data() + m.rowPtr[user];
+            uint32_t n = m.rowPtr[user + 1] - m.rowPtr[user];
+            for (uint32_t j = 0; j < n; ++j)
+            {
+                if (acc[books[j]] == 0.0f)
+                    touched.push_back(books[j]);
+                acc[books[j]] += weight * values[j];
+            }
+        }
+    }
+
+    static std::vector<SimilarBook> topNeighbors(const Matrix &m, uint32_t b, std::vector<float> &acc, std::vector<uint32_t> &touched)
+    {
+        std::vector<SimilarBook> top;
+        for (uint32_t j : touched)
+        {
+            if (j != b && acc[j] > 0.0f)
+                top.push_back({m.bookIds[j], acc[j]});
+        }
+        size_t keep = std::min(top.size(), kSimilarNeighbors);
+        std::partial_sort(top.begin(), top.begin() + keep, top.end(), byScore);
+        top.resize(keep);
+        return top;
+    }
+
+    static bool byScore(const SimilarBook &a, const SimilarBook &b)
+    {
+        if (a.similarity != b.similarity)
+            return a.similarity > b.similarity;
+        return a.bookId < b.bookId;
+    }
+
+    // top K for every book, books interleaved across threads
+    //
+    static std::unique_ptr<SimilarityModel> buildAll(const Matrix &m, size_t workers)
+    {
+        size_t books = m.bookIds.size();
+        std::vector<std::vector<std::vector<SimilarBook>>> results(workers);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < workers; ++w)
+        {
+            threads.emplace_back([&, w]()
+                                 {
+                std::vector<float> acc(books, 0.0f);
+                std::vector<uint32_t> touched;
+                for (size_t b = w; b < books; b += workers)
+                {
+                    scoreBook(m, static_cast<uint32_t>(b), acc, touched);
+                    results[w].push_back(topNeighbors(m, static_cast<uint32_t>(b), acc, touched));
+                    for (uint32_t j : touched)
+                        acc[j] = 0.0f;
+                } });
+        }
+        for (auto &t : threads)
+            t.join();
+
+        auto model = std::make_unique<SimilarityModel>();
+        model->neighbors.reserve(books);
+        for (size_t w = 0; w < workers; ++w)
+        {
+            for (size_t n = 0; n < results[w].size(); ++n)
+            {
+                if (!results[w][n].empty())
+                    model->neighbors.emplace(m.bookIds[w + n * workers], std::move(results[w][n]));
+            }
+        }
+        return model;
+    }
+
+    // recomputing only the dirty books and patching their scores into the
+    // lists of the books they are co-rated with
+    //
+    static std::unique_ptr<SimilarityModel> buildDirty(const Matrix &m, const SimilarityModel &previous, const std::unordered_set<int> &dirty)
+    {
+        auto model = std::make_unique<SimilarityModel>(previous);
+        std::vector<float> acc(m.bookIds.size(), 0.0f);
+        std::vector<uint32_t> touched;
+
+        for (int bookId : dirty)
+        {
+            auto index = m.bookIndex.find(bookId);
+            std::vector<int> stale;
+            auto old = model->neighbors.find(bookId);
+            if (old != model->neighbors.end())
+            {
+                for (const auto &n : old->second)
+                    stale.push_back(n.bookId);
+            }
+
+            if (index == m.bookIndex.end())
+            {
+                model->neighbors.erase(bookId); // no ratings left
+            }
+            else
+            {
+                scoreBook(m, index->second, acc, touched);
+                model->neighbors[bookId] = topNeighbors(m, index->second, acc, touched);
+                for (uint32_t j : touched)
+                {
+                    if (j != index->second && acc[j] > 0.0f)
+                        patch(*model, m.bookIds[j], bookId, acc[j]);
+                }
+                for (uint32_t j : touched)
+                    acc[j] = 0.0f;
+            }
+
+            // neighbours that no longer share a reader with this book
+            for (int other : stale)
+            {
+                auto j = m.bookIndex.find(other);
+                bool stillTouched = index != m.bookIndex.end() && j != m.bookIndex.end() &&
+                                    std::find(touched.begin(), touched.end(), j->second) != touched.end();
+                if (!stillTouched)
+                    patch(*model, other, bookId, 0.0f);
+            }
+        }
+        return model;
+    }
+
+    static void patch(SimilarityModel &model, int bookId, int neighborId, float similarity)
+    {
+        auto &list = model.neighbors[bookId];
+        list.erase(std::remove_if(list.begin(), list.end(), [neighborId](const SimilarBook &n)
+                                  { return n.bookId == neighborId; }),
+                   list.end());
+        if (similarity > 0.0f)
+        {
+            list.push_back({neighborId, similarity});
+            std::sort(list.begin(), list.end(), byScore);
+            if (list.size() > kSimilarNeighbors)
+                list.resize(kSimilarNeighbors);
+        }
+        if (list.empty())
+            model.neighbors.erase(bookId);
+    }
+
+    void run(std::chrono::milliseconds debounce)
+    {
+        int rounds = 0;
+        for (;;)
+        {
+            std::vector<Change> changes;
+            bool full;
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this]
+                           { return stopping_ || fullRebuild_ || !pending_.empty(); });
+                if (stopping_)
+                    return;
+                if (!fullRebuild_)
+                    wake_.wait_for(lock, debounce, [this]
+                                   { return stopping_; }); // let reviews pile up
+                if (stopping_)
+                    return;
+
+                full = fullRebuild_ || ++rounds % kSimilarFullRebuildEvery == 0;
+                fullRebuild_ = false;
+                changes.swap(pending_);
+            }
+
+            auto started = std::chrono::steady_clock::now();
+            std::unordered_set<int> dirty;
+            for (const auto &change : changes)
+            {
+                apply(change);
+                dirty.insert(change.bookId);
+            }
+            std::unique_ptr<Matrix> matrix = buildMatrix();
+            std::unique_ptr<SimilarityModel> next;
+            {
+                auto current = model_.read();
+                if (full || !current)
+                    next = buildAll(*matrix, threads_);
+                else
+                    next = buildDirty(*matrix, *current, dirty);
+            }
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+            if (full)
+            {
+                std::cout << "similar books: " << matrix->bookIds.size() << " books, " << matrix->rowBooks.size() << " ratings, "
+                          << matrix->memoryBytes() / 1024 << " KiB matrix, built in " << ms << " ms" << std::endl;
+            }
+
+            std::lock_guard<std::mutex> lock(model_.writerMutex());
+            model_.publish(std::move(next));
+        }
+    }
+
+    std::mutex mutex_; // guards pending_, fullRebuild_ and stopping_
+    std::condition_variable wake_;
+    std::vector<Change> pending_;
+    bool fullRebuild_ = false;
+    bool stopping_ = false;
+    std::unordered_map<int, std::vector<Rating>> byUser_; // worker thread only, after start()
+    size_t threads_ = 1;
+    std::thread worker_;
+    RcuCell<SimilarityModel> model_;
+};
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+// streaming json writer
+//
+// appends straight into a string instead of building a crow::json::wvalue
+// tree first, for responses that are large lists of flat rows. keys are
+// trusted literals and written as is; string values are escaped.
+
+class JsonWriter
+{
+public:
+    explicit JsonWriter(std::string &out) : out_(out) {}
+
+    static constexpr const char *contentType = "application/json";
+
+    void beginArray()
+    {
+        separate();
+        out_ += '[';
+        needComma_ = false;
+    }
+
+    void endArray()
+    {
+        out_ += ']';
+        needComma_ = true;
+    }
+
+    void beginObject(size_t /*fields*/)
+    {
+        separate();
+        out_ += '{';
+        needComma_ = false;
+    }
+
+    void endObject()
+    {
+        out_ += '}';
+        needComma_ = true;
+    }
+
+    void key(const char *name)
+    {
+        separate();
+        out_ += '"';
+        out_ += name;
+        out_ += "\":";
+        needComma_ = false;
+    }
+
+    void integer(int64_t value)
+    {
+        separate();
+        char digits[24];
+        auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+        out_.append(digits, end - digits);
+        needComma_ = true;
+    }
+
+    // shortest text that reads back as the same double; json has no nan or infinity
+    void number(double value)
+    {
+        separate();
+        if (std::isfinite(value))
+        {
+            char digits[32];
+            auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+            out_.append(digits, end - digits);
+        }
+        else
+            out_ += "null";
+        needComma_ = true;
+    }
+
+    void string(const char *text, size_t length)
+    {
+        separate();
+        out_ += '"';
+        size_t run = 0; // start of the pending run of bytes that need no escaping
+        for (size_t i = 0; i < length; ++i)
+        {
+            unsigned char c = static_cast<unsigned char>(text[i]);
+            if (c >= 0x20 && c != '"' && c != '\\')
+                continue;
+            out_.append(text + run, i - run);
+            run = i + 1;
+            switch (c)
+            {
+            case '"':
+                out_ += "\\\"";
+                break;
+            case '\\':
+                out_ += "\\\\";
+                break;
+            case '\n':
+                out_ += "\\n";
+                break;
+            case '\r':
+                out_ += "\\r";
+                break;
+            case '\t':
+                out_ += "\\t";
+                break;
+            default:
+            {
+                static const char hex[] = "0123456789abcdef";
+                char escaped[] = {'\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xF]};
+                out_.append(escaped, sizeof(escaped));
+            }
+            }
+        }
+        out_.append(text + run, length - run);
+        out_ += '"';
+        needComma_ = true;
+    }
+
+    void string(const char *text)
+    {
+        string(text, std::strlen(text));
+    }
+
+    void null()
+    {
+        separate();
+        out_ += "null";
+        needComma_ = true;
+    }
+
+    void boolean(bool value)
+    {
+        separate();
+        out_ += value ? "true" : "false";
+        needComma_ = true;
+    }
+
+private:
+    void separate()
+    {
+        if (needComma_)
+            out_ += ',';
+    }
+
+    std::string &out_;
+    bool needComma_ = false;
+};
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "metrics.h"
+
+// priority lanes: separate executors for cheap reads, sqlite writes and bcrypt
+//
+// a lane owns its worker threads and a bounded queue. its weight is its
+// thread count, the share of the machine it may occupy, so a flood of logins
+// can hold at most the auth lane's threads and reads keep the rest. a lane
+// that was never started runs its tasks on the calling thread ( reads stay on
+// crow's io threads ). a full queue refuses the task and the caller answers
+// 503. queueing and service time are measured separately per lane.
+
+class Lane
+{
+public:
+    Lane(const std::string &name, size_t queueCapacity)
+        : name_(name), capacity_(queueCapacity),
+          queueSeconds_(metrics::summary("lane_queue_seconds{lane=\"" + name + "\"}", "time tasks waited for a lane thread")),
+          serviceSeconds_(metrics::summary("lane_service_seconds{lane=\"" + name + "\"}", "time tasks ran on a lane")),
+          depth_(metrics::gauge("lane_queue_depth{lane=\"" + name + "\"}", "tasks waiting per lane")),
+          rejected_(metrics::counter("lane_rejected_total{lane=\"" + name + "\"}", "tasks refused because the lane queue was full"))
+    {
+    }
+
+    ~Lane()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        for (auto &worker : workers_)
+            worker.join();
+    }
+
+    // starting the lane's threads; until then tasks run on the submitting thread
+    //
+    void start(unsigned threads)
+    {
+        metrics::gauge("lane_threads{lane=\"" + name_ + "\"}", "worker threads per lane").set(threads);
+        for (unsigned i = 0; i < threads; ++i)
+            workers_.emplace_back([this]()
+                                  { work(); });
+    }
+
+    // queueing a task, false when the queue is full
+    //
+    bool submit(std::function<void()> task)
+    {
+        if (workers_.empty())
+        {
+            run(task, std::chrono::steady_clock::now());
+            return true;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (queue_.size() >= capacity_)
+            {
+                rejected_.inc();
+                return false;
+            }
+            queue_.push_back({std::move(task), std::chrono::steady_clock::now()});
+            depth_.set(static_cast<double>(queue_.size()));
+        }
+        wake_.notify_one();
+        return true;
+    }
+
+private:
+    struct Queued
+    {
+        std::function<void()> task;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true)
+        {
+            wake_.wait(lock, [this]()
+                       { return stopping_ || !queue_.empty(); });
+            if (stopping_)
+                return;
+            Queued next = std::move(queue_.front());
+            queue_.pop_front();
+            depth_.set(static_cast<double>(queue_.size()));
+            lock.unlock();
+            run(next.task, next.queuedAt);
+            lock.lock();
+        }
+    }
+
+    void run(const std::function<void()> &task, std::chrono::steady_clock::time_point queuedAt)
+    {
+        auto start = std::chrono::steady_clock::now();
+        queueSeconds_.observe(std::chrono::duration<double>(start - queuedAt).count());
+        task();
+        serviceSeconds_.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+
+    const std::string name_;
+    const size_t capacity_;
+    metrics::Summary &queueSeconds_;
+    metrics::Summary &serviceSeconds_;
+    metrics::Gauge &depth_;
+    metrics::Counter &rejected_;
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::deque<Queued> queue_;
+    std::vector<std::thread> workers_;
+};
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <mutex>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "catalog_events.h"
+
+// top-rated and most-reviewed books
+//
+// per-book review count and rating sum, plus three ordered sets ( by count, by
+// plain average, by bayesian average ) that are adjusted in O(log n) on every
+// review write. the bayesian average pulls books with few reviews towards the
+// catalog mean: ( C * mean + sum ) / ( C + count ). the mean is taken when the
+// board is built, so scores only move when that book's own reviews change.
+
+constexpr size_t kLeaderboardMaxK = 100;
+constexpr double kBayesianPriorWeight = 10.0;
+
+enum class LeaderboardOrder
+{
+    Count,
+    Average,
+    Bayesian
+};
+
+struct LeaderboardEntry
+{
+    int bookId;
+    uint32_t count;
+    double average;
+    double score;
+};
+
+class Leaderboard
+{
+public:
+    // rebuilding from the reviews table, one rowid range per thread
+    //
+    bool rebuild(const char *dbName)
+    {
+        int64_t maxId = 0;
+        {
+            sqlite3 *db;
+            if (sqlite3_open(dbName, &db) != SQLITE_OK)
+            {
+                std::cerr << "leaderboard: cannot open database: " << sqlite3_errmsg(db) << std::endl;
+                sqlite3_close(db);
+                return false;
+            }
+            sqlite3_busy_timeout(db, 5000);
+            sqlite3_stmt *stmt = nullptr;
+            if (sqlite3_prepare_v2(db, "SELECT COALESCE(MAX(id), 0) FROM reviews;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+                maxId = sqlite3_column_int64(stmt, 0);
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+        }
+
+        size_t workers = std::max(1u, std::thread::hardware_concurrency());
+        workers = static_cast<size_t>(std::min<int64_t>(workers, std::max<int64_t>(1, maxId / 50000)));
+        int64_t span = maxId / static_cast<int64_t>(workers) + 1;
+
+        std::vector<std::unordered_map<int, Stats>> partials(workers);
+        std::vector<char> ok(workers, 0);
+        std::vector<std::thread> threads;
+        for (size_t w = 0; w < workers; ++w)
+        {
+            threads.emplace_back([&, w]()
+                                 { ok[w] = aggregateRange(dbName, w * span + 1, (w + 1) * span, partials[w]); });
+        }
+        for (auto &t : threads)
+            t.join();
+        if (std::find(ok.begin(), ok.end(), 0) != ok.end())
+            return false;
+
+        std::unordered_map<int, Stats> stats = std::move(partials[0]);
+        for (size_t w = 1; w < workers; ++w)
+        {
+            for (const auto &entry : partials[w])
+            {
+                Stats &s = stats[entry.first];
+                s.count += entry.second.count;
+                s.sum += entry.second.sum;
+            }
+        }
+
+        uint64_t totalCount = 0, totalSum = 0;
+        for (const auto &entry : stats)
+        {
+            totalCount += entry.second.count;
+            totalSum += entry.second.sum;
+        }
+
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        stats_ = std::move(stats);
+        priorMean_ = totalCount ? static_cast<double>(totalSum) / totalCount : 3.0;
+        byCount_.clear();
+        byAverage_.clear();
+        byBayesian_.clear();
+        for (const auto &entry : stats_)
+            insertKeys(entry.first, entry.second);
+        return true;
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        std::unique_lock<std::shared_mutex> lock(mutex_);
+        Stats &s = stats_[change.book_id];
+        eraseKeys(change.book_id, s);
+
+        switch (change.kind)
+        {
+        case catalog::ReviewChange::Kind::Added:
+            s.count += 1;
+            s.sum += change.rating;
+            break;
+        case catalog::ReviewChange::Kind::Edited:
+            s.sum += change.rating - change.old_rating;
+            break;
+        case catalog::ReviewChange::Kind::Deleted:
+            s.count = s.count > 0 ? s.count - 1 : 0;
+            s.sum = s.sum > static_cast<uint64_t>(change.rating) ? s.sum - change.rating : 0;
+            break;
+        }
+
+        if (s.count == 0)
+            stats_.erase(change.book_id);
+        else
+            insertKeys(change.book_id, s);
+    }
+
+    std::vector<LeaderboardEntry> top(LeaderboardOrder order, size_t k) const
+    {
+        std::vector<LeaderboardEntry> entries;
+        k = std::min(k, kLeaderboardMaxK);
+
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+        const std::set<Key> &keys = order == LeaderboardOrder::Count     ? byCount_
+                                    : order == LeaderboardOrder::Average ? byAverage_
+                                                                         : byBayesian_;
+        for (auto it = keys.begin(); it != keys.end() && entries.size() < k; ++it)
+        {
+            const Stats &s = stats_.at(it->bookId);
+            entries.push_back({it->bookId, s.count, average(s), order == LeaderboardOrder::Count ? s.count : it->score});
+        }
+        return entries;
+    }
+
+private:
+    struct Stats
+    {
+        uint32_t count = 0;
+        uint64_t sum = 0;
+    };
+
+    // best first: higher score, then more reviews, then lower id
+    struct Key
+    {
+        double score;
+        uint32_t count;
+        int bookId;
+
+        bool operator<(const Key &other) const
+        {
+            if (score != other.score)
+                return score > other.score;
+            if (count != other.count)
+                return count > other.count;
+            return bookId < other.bookId;
+        }
+    };
+
+    static double average(const Stats &s)
+    {
+        return s.count ? static_cast<double>(s.sum) / s.count : 0;
+    }
+
+    double bayesian(const Stats &s) const
+    {
+        return (kBayesianPriorWeight * priorMean_ + s.sum) / (kBayesianPriorWeight + s.count);
+    }
+
+    void insertKeys(int bookId, const Stats &s)
+    {
+        byCount_.insert({static_cast<double>(s.count), s.count, bookId});
+        byAverage_.insert({average(s), s.count, bookId});
+        byBayesian_.insert({bayesian(s), s.count, bookId});
+    }
+
+    void eraseKeys(int bookId, const Stats &s)
+    {
+        if (s.count == 0)
+            return;
+        byCount_.erase({static_cast<double>(s.count), s.count, bookId});
+        byAverage_.erase({average(s), s.count, bookId});
+        byBayesian_.erase({bayesian(s), s.count, bookId});
+    }
+
+    static bool aggregateRange(const char *dbName, int64_t fromId, int64_t toId, std::unordered_map<int, Stats> &out)
+    {
+        sqlite3 *db;
+        if (sqlite3_open_v2(dbName, &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        const char *sql = "SELECT book_id, COUNT(*), SUM(rating) FROM reviews WHERE id BETWEEN ? AND ? GROUP BY book_id;";
+        sqlite3_stmt *stmt = nullptr;
+        int rc = SQLITE_ERROR;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            sqlite3_bind_int64(stmt, 1, fromId);
+            sqlite3_bind_int64(stmt, 2, toId);
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                Stats &s = out[sqlite3_column_int(stmt, 0)];
+                s.count = static_cast<uint32_t>(sqlite3_column_int64(stmt, 1));
+                s.sum = static_cast<uint64_t>(sqlite3_column_int64(stmt, 2));
+            }
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return rc == SQLITE_DONE;
+    }
+
+    mutable std::shared_mutex mutex_;
+    std::unordered_map<int, Stats> stats_;
+    double priorMean_ = 3.0;
+    std::set<Key> byCount_;
+    std::set<Key> byAverage_;
+    std::set<Key> byBayesian_;
+};
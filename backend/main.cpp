@@ -2,7 +2,36 @@
 #include <sqlite3.h>
 #include <iostream>
 #include <string>
+#include <fstream>
+#include <climits>
 #include "bcrypt/BCrypt.hpp"
+#include "password_cost.h"
+#include "catalog_import.h"
+#include "search.h"
+#include "title_suggest.h"
+#include "trigram_index.h"
+#include "leaderboard.h"
+#include "item_similarity.h"
+#include "matrix_factorization.h"
+#include "review_timestamps.h"
+#include "trending.h"
+#include "review_ownership.h"
+#include "review_cache.h"
+#include "json_writer.h"
+#include "book_listing.h"
+#include "response_format.h"
+#include "review_stream.h"
+#include "change_log.h"
+#include "catalog_snapshot.h"
+#include "metrics.h"
+#include "registration_filter.h"
+#include "rate_limit.h"
+#include "concurrency_limit.h"
+#include "lanes.h"
+#include "deadline.h"
+#include "single_flight.h"
+#include "response_cache.h"
+#include "hot_books.h"
 
 // creating db and tables
 //
@@ -19,6 +48,14 @@ static bool createDBAndTables(const char *dbName)
         return false;
     }
 
+    // the server handles requests on several threads next to background readers and writers;
+    // in wal mode readers never wait for a writer. the mode is stored in the file
+    if (sqlite3_exec(db, "PRAGMA journal_mode = WAL;", nullptr, 0, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "failed to enable wal: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+    }
+
     const char *sql_users = R"(
         CREATE TABLE IF NOT EXISTS users (
             id INTEGER PRIMARY KEY AUTOINCREMENT,
@@ -45,6 +82,8 @@ static bool createDBAndTables(const char *dbName)
             book_id INTEGER NOT NULL,
             rating INTEGER NOT NULL,
             comment TEXT,
+            created_at INTEGER,
+            updated_at INTEGER,
             FOREIGN KEY(user_id) REFERENCES users(id),
             FOREIGN KEY(book_id) REFERENCES books(id)
         );
@@ -68,6 +107,26 @@ static bool createDBAndTables(const char *dbName)
         sqlite3_free(errMsg);
     }
 
+    // per-book review lists, newest first
+    const char *sql_reviews_book_index = "CREATE INDEX IF NOT EXISTS idx_reviews_book ON reviews(book_id, id);";
+    if (sqlite3_exec(db, sql_reviews_book_index, nullptr, 0, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "failed to create reviews book index: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+    }
+
+    // per-user listing and ownership lookups
+    const char *sql_reviews_user_index = "CREATE INDEX IF NOT EXISTS idx_reviews_user ON reviews(user_id, id);";
+    if (sqlite3_exec(db, sql_reviews_user_index, nullptr, 0, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "failed to create reviews user index: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+    }
+
+    migrateReviewTimestamps(db);
+    ensureSearchSchema(db);
+    ensureChangeLogSchema(db);
+
     sqlite3_close(db);
     std::cout << "database and tables created successfully.\n";
     return true;
@@ -83,14 +142,130 @@ sqlite3 *openDB(const char *dbName)
         std::cerr << "error in opening db:" << sqlite3_errmsg(db) << std::endl;
         return nullptr;
     }
+    // writers take turns instead of failing with SQLITE_BUSY
+    sqlite3_busy_timeout(db, 5000);
+    // statements give up when the request being handled runs out of time
+    if (currentDeadline)
+    {
+        currentDeadline->watch(db);
+    }
     return db;
 }
 
+// reading an integer query parameter, clamped to [min, max]
+//
+static int intParam(const crow::request &req, const char *name, int fallback, int min, int max)
+{
+    const char *value = req.url_params.get(name);
+    if (!value || !*value)
+    {
+        return fallback;
+    }
+    char *end = nullptr;
+    long parsed = std::strtol(value, &end, 10);
+    if (*end != '\0')
+    {
+        return fallback;
+    }
+    return static_cast<int>(std::max<long>(min, std::min<long>(max, parsed)));
+}
+
+// reading a comma separated list of ids ( 1,2,3 ), duplicates dropped
+//
+static bool parseIdList(const char *value, size_t maxIds, std::vector<int> &ids)
+{
+    if (!value || !*value)
+    {
+        return false;
+    }
+    std::unordered_set<int> seen;
+    const char *p = value;
+    while (*p)
+    {
+        char *end = nullptr;
+        long id = std::strtol(p, &end, 10);
+        if (end == p || id < 1 || id > INT_MAX || (*end != ',' && *end != '\0'))
+        {
+            return false;
+        }
+        if (seen.insert(static_cast<int>(id)).second)
+        {
+            ids.push_back(static_cast<int>(id));
+        }
+        if (ids.size() > maxIds)
+        {
+            return false;
+        }
+        p = *end == ',' ? end + 1 : end;
+    }
+    return !ids.empty();
+}
+
+// title and image for a set of books, in one query
+//
+static std::unordered_map<int, std::pair<std::string, std::string>> fetchBookCards(sqlite3 *db, const std::vector<int> &ids)
+{
+    std::unordered_map<int, std::pair<std::string, std::string>> books;
+    if (ids.empty())
+    {
+        return books;
+    }
+
+    std::string sql = "SELECT id, title, image_url FROM books WHERE id IN (";
+    for (size_t i = 0; i < ids.size(); ++i)
+    {
+        sql += i == 0 ? "?" : ", ?";
+    }
+    sql += ");";
+
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        for (size_t i = 0; i < ids.size(); ++i)
+        {
+            sqlite3_bind_int(stmt, static_cast<int>(i) + 1, ids[i]);
+        }
+        while (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            books[sqlite3_column_int(stmt, 0)] = {columnText(stmt, 1), columnText(stmt, 2)};
+        }
+    }
+    sqlite3_finalize(stmt);
+    return books;
+}
+
+// one review, as written in the review list documents
+//
+template <class Writer>
+static void writeReview(Writer &out, int id, int rating, const std::string &comment, const std::string &username)
+{
+    out.beginObject(4);
+    out.key("id");
+    out.integer(id);
+    out.key("rating");
+    out.integer(rating);
+    out.key("comment");
+    out.string(comment.data(), comment.size());
+    out.key("username");
+    out.string(username.data(), username.size());
+    out.endObject();
+}
+
+// sending a body encoded in the negotiated format
+//
+static void writeEncoded(crow::response &res, ResponseFormat format, const std::string &body)
+{
+    res.set_header("Content-Type", formatContentType(format));
+    res.set_header("Vary", "Accept");
+    res.code = 200;
+    res.write(body);
+}
+
 // hashing passwords
 //
 std::string hashPassword(const std::string &password)
 {
-    return BCrypt::generateHash(password);
+    return BCrypt::generateHash(password, passwordCost.load(std::memory_order_relaxed));
 }
 
 // verifying passwords
@@ -110,6 +285,7 @@ bool storeUser(const std::string &username, const std::string &email, const std:
         sqlite3_close(db);
         return false;
     }
+    sqlite3_busy_timeout(db, 5000);
 
     sqlite3_stmt *stmt;
     const char *sql = "INSERT INTO users (username, email, password) VALUES (?, ?, ?);";
@@ -132,6 +308,37 @@ bool storeUser(const std::string &username, const std::string &email, const std:
     return exit == SQLITE_DONE;
 }
 
+// replacing a hash made at an older cost, right after the password was verified
+//
+// only if the stored hash is still the one that was checked, so a password
+// changed in the meantime is not overwritten
+static void rehashPassword(const std::string &username, const std::string &oldHash, const std::string &password)
+{
+    static metrics::Counter &rehashed = metrics::counter("password_rehash_total", "hashes upgraded to the current bcrypt cost at login");
+
+    std::string newHash = hashPassword(password);
+    sqlite3 *db = openDB("book_review.sqlite");
+    if (!db)
+    {
+        return;
+    }
+
+    sqlite3_stmt *stmt;
+    const char *sql = "UPDATE users SET password = ? WHERE username = ? AND password = ?;";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        sqlite3_bind_text(stmt, 1, newHash.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, username.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 3, oldHash.c_str(), -1, SQLITE_TRANSIENT);
+        if (sqlite3_step(stmt) == SQLITE_DONE && sqlite3_changes(db) > 0)
+        {
+            rehashed.inc();
+        }
+    }
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+}
+
 // checking if user doesnt exist in db ( for signup )
 bool verifyUser(const std::string &username, const std::string &password)
 {
@@ -144,6 +351,7 @@ bool verifyUser(const std::string &username, const std::string &password)
         sqlite3_close(db);
         return false;
     }
+    sqlite3_busy_timeout(db, 5000);
 
     sqlite3_stmt *stmt;
     const char *sql = "SELECT password FROM users WHERE username = ?;";
@@ -172,174 +380,834 @@ bool verifyUser(const std::string &username, const std::string &password)
     sqlite3_finalize(stmt);
     sqlite3_close(db);
 
-    return verifyPassword(password, storedHash);
+    if (!verifyPassword(password, storedHash))
+    {
+        return false;
+    }
+    if (needsRehash(storedHash))
+    {
+        rehashPassword(username, storedHash, password);
+    }
+    return true;
 }
 
-// main
-int main()
+// checking that the user exists, the password matches and the account is an admin
+bool verifyAdmin(const std::string &username, const std::string &password)
 {
-    // init db
-    if (!createDBAndTables("book_review.sqlite"))
+    if (username.empty() || password.empty() || !verifyUser(username, password))
     {
-        return 1;
+        return false;
     }
 
-    // crow backend
+    sqlite3 *db = openDB("book_review.sqlite");
+    if (!db)
+    {
+        return false;
+    }
 
-    crow::SimpleApp app;
+    sqlite3_stmt *stmt;
+    const char *sql = "SELECT is_admin FROM users WHERE username = ?;";
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        sqlite3_close(db);
+        return false;
+    }
 
-    // defining an endpoint in the root dir
-    CROW_ROUTE(app, "/")([]()
-                         { return "Book review backend is running!!"; });
+    sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+    bool isAdmin = sqlite3_step(stmt) == SQLITE_ROW && sqlite3_column_int(stmt, 0) != 0;
 
-    // registration
-    CROW_ROUTE(app, "/register").methods(crow::HTTPMethod::POST)([](const crow::request &req)
-                                                                 {
-        auto body = crow::json::load(req.body);
-        if (!body) return crow::response(400, "Invalid JSON");
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
 
-        std::string username = body["username"].s();
-        std::string email = body["email"].s();
-        std::string password = body["password"].s();
+    return isAdmin;
+}
 
-        if (username.empty() || email.empty() || password.empty()) {
-            return crow::response(400, "Missing username or password");
-        }
+// picking the import format from ?format= or the content type ( csv by default )
+static ImportFormat importFormatFor(const std::string &format, const std::string &contentType)
+{
+    if (format == "ndjson" || format == "jsonl")
+    {
+        return ImportFormat::NDJSON;
+    }
+    if (format.empty() && (contentType.find("ndjson") != std::string::npos || contentType.find("jsonl") != std::string::npos))
+    {
+        return ImportFormat::NDJSON;
+    }
+    return ImportFormat::CSV;
+}
 
-        std::string hashed = hashPassword(password); 
-        
-        if (!storeUser(username, email, hashed)) {
-            return crow::response(400, "User already exists");
-        }
+// command line bulk import: backend import <file> [csv|ndjson]
+static int runImportCommand(int argc, char *argv[])
+{
+    if (argc < 3)
+    {
+        std::cerr << "usage: " << argv[0] << " import <file> [csv|ndjson]" << std::endl;
+        return 1;
+    }
 
-        // create user
-        return crow::response(200, "User registered"); });
+    std::string path = argv[2];
+    std::string format = argc > 3 ? argv[3] : "";
+    if (format.empty())
+    {
+        format = path.substr(path.find_last_of('.') + 1);
+    }
 
-    // login
-    CROW_ROUTE(app, "/login").methods(crow::HTTPMethod::POST)([](const crow::request &req)
-                                                              {
-        auto body = crow::json::load(req.body);
-        if (!body) return crow::response(400, "Invalid JSON");
+    std::ifstream in(path, std::ios::binary);
+    if (!in)
+    {
+        std::cerr << "cannot open " << path << std::endl;
+        return 1;
+    }
 
-        std::string username = body["username"].s();
-        std::string password = body["password"].s();
+    ImportStats stats = importBooks("book_review.sqlite", in, importFormatFor(format, ""));
+    for (const auto &error : stats.errors)
+    {
+        std::cerr << error << std::endl;
+    }
+    std::cout << "parsed " << stats.parsed << ", inserted " << stats.inserted << ", rejected " << stats.rejected
+              << " in " << stats.seconds << "s (" << static_cast<long>(stats.rowsPerSecond()) << " rows/s)" << std::endl;
+    return stats.inserted > 0 || stats.parsed == 0 ? 0 : 1;
+}
 
-        if (username.empty() || password.empty()) {
-            return crow::response(400, "Missing username or password");
-        }
+// in-memory indexes derived from the catalog
+static TitleSuggestIndex titleSuggest;
+static TrigramIndex trigramIndex;
+static Leaderboard leaderboard;
+static ItemSimilarity itemSimilarity;
+static MatrixFactorization recommender("book_review.factors");
+static ReviewTimestampBackfill timestampBackfill;
+static TrendingBooks trending;
+static ReviewOwnershipCache reviewOwnership;
+static ReviewListCache reviewLists;
+static ReviewEventBus reviewEvents;
+static ChangeLogPruner changeLogPruner;
+static CatalogSnapshotter catalogSnapshot("book_review.snapshot.gz");
+static RegistrationFilter registrationFilter;
+static RateLimiter rateLimiter;
 
-        if (verifyUser(username, password)) {
-            return crow::response(200, "Login successful");
-        } else {
-            return crow::response(401, "Invalid username or password");
-        } });
+// executors per kind of route: reads inline on crow's threads, sqlite writes one at a time, bcrypt on its own pool
+static Lane readLane("read", 0);
+static Lane writeLane("write", 256);
+static Lane authLane("auth", 64);
 
-    // getting all books
-    CROW_ROUTE(app, "/books").methods(crow::HTTPMethod::GET)([](const crow::request &req, crow::response &res)
-                                                             {
-    sqlite3* db = openDB("book_review.sqlite");
-    if (!db) {
-        res.code = 500;
-        res.write("failed to open database.");
-        res.end();
-        return;
+// per route limits for the routes that run bcrypt: { per ip }, { per username }, in requests per second and burst
+static const RouteLimits kLoginLimits{{1.0, 10}, {0.1, 5}};
+static const RouteLimits kRegisterLimits{{0.2, 5}, {0.1, 3}};
+static const RouteLimits kAdminLimits{{0.1, 5}, {0.1, 5}};
+
+// taking a token for one client of a route; false and the wait in seconds when there is none
+//
+static bool admitClient(const char *route, const char *kind, const std::string &client, const RateRule &rule, int64_t &retryAfter)
+{
+    static metrics::Counter &limited = metrics::counter("rate_limited_total", "requests refused by the per client rate limits");
+    static metrics::Counter &untracked = metrics::counter("rate_limit_untracked_total", "requests let through because the limiter table was full");
+
+    int64_t retryAfterMs = 0;
+    switch (rateLimiter.acquire(std::string(route) + '|' + kind + '|' + client, rule, retryAfterMs))
+    {
+    case RateDecision::Limited:
+        limited.inc();
+        retryAfter = std::max<int64_t>(1, (retryAfterMs + 999) / 1000);
+        return false;
+    case RateDecision::Untracked:
+        untracked.inc();
+        return true;
+    default:
+        return true;
     }
+}
 
-    const char* sql = "SELECT id, title, summary, image_url FROM books;";
-    sqlite3_stmt* stmt = nullptr;
+static crow::response tooManyRequests(int64_t retryAfter)
+{
+    crow::response res(429, "too many requests");
+    res.set_header("Retry-After", std::to_string(retryAfter));
+    return res;
+}
 
-    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        sqlite3_close(db);
-        res.code = 500;
-        res.write("failed to prepare statement.");
-        res.end();
-        return;
+// latency targets for the adaptive concurrency limits, by kind of route
+constexpr std::chrono::milliseconds kReadLatencyTarget{200};
+constexpr std::chrono::milliseconds kWriteLatencyTarget{500};
+constexpr std::chrono::milliseconds kAuthLatencyTarget{1000}; // one bcrypt hash is calibrated to 250ms by default
+
+// the time the client is still willing to wait, from X-Request-Timeout-Ms ( 0 when not given )
+//
+static int64_t requestBudgetMs(const crow::request &req)
+{
+    const std::string &value = req.get_header_value("X-Request-Timeout-Ms");
+    return value.empty() ? 0 : std::max(0LL, std::atoll(value.c_str()));
+}
+
+static crow::response serviceUnavailable()
+{
+    crow::response res(503, "server busy, try again shortly");
+    res.set_header("Retry-After", "1");
+    return res;
+}
+
+// time limits per kind of route, counted from arrival; a client can ask for less with X-Request-Timeout-Ms
+constexpr std::chrono::milliseconds kReadDeadline{3000};
+constexpr std::chrono::milliseconds kNoDeadline{0}; // writes are not interrupted halfway
+
+// sending what a handler wrote into a buffered response, or a 504 when its deadline cut it short
+//
+static void finishResponse(crow::response &res, crow::response &written, const RequestDeadline *deadline)
+{
+    static metrics::Counter &timedOut = metrics::counter("requests_timed_out_total", "requests answered 504 after their deadline interrupted sqlite");
+
+    RequestDeadline::Outcome outcome = deadline ? deadline->outcome() : RequestDeadline::Outcome::Running;
+    if (outcome == RequestDeadline::Outcome::TimedOut)
+    {
+        timedOut.inc();
+        res.code = 504;
+        res.write("request timed out");
+    }
+    else
+    {
+        res.code = written.code;
+        res.headers = std::move(written.headers);
+        res.body = std::move(written.body);
+    }
+    res.end();
+}
+
+// admitting a request to a route, an empty pointer when its limiter sheds it
+//
+// taken before the request queues for a lane and shared with the queued task,
+// which releases it once the response is written: the limiter's latency runs
+// from arrival to finish, so a lane whose queue grows pushes its routes over
+// their targets and their limits come down
+static std::shared_ptr<ConcurrencyLimiter::Permit> admit(ConcurrencyLimiter &limiter, const crow::request &req)
+{
+    auto permit = limiter.tryAcquire(requestBudgetMs(req));
+    if (!permit)
+    {
+        return nullptr;
     }
+    return std::make_shared<ConcurrencyLimiter::Permit>(std::move(permit));
+}
 
-    crow::json::wvalue books = crow::json::wvalue::list();
-    int index = 0;
+// running a route handler on a lane, 503 when the route's limiter sheds it or the lane's queue is full
+//
+// the handler ends the response from the lane's thread; crow keeps the request
+// and response alive until it does. with a deadline, the handler writes into a
+// buffer so a query cut short can still be answered with a 504
+template <class... Args, class Handler>
+static std::function<void(const crow::request &, crow::response &, Args...)> onLane(Lane &lane, ConcurrencyLimiter &limiter, std::chrono::milliseconds timeout, Handler handler)
+{
+    return [&lane, &limiter, timeout, handler](const crow::request &req, crow::response &res, Args... args)
+    {
+        auto permit = admit(limiter, req);
+        if (!permit)
+        {
+            res = serviceUnavailable();
+            return res.end();
+        }
 
-    while (sqlite3_step(stmt) == SQLITE_ROW) {
-        crow::json::wvalue book;
-        book["id"] = sqlite3_column_int(stmt, 0);
+        std::shared_ptr<RequestDeadline> deadline;
+        if (timeout.count() > 0)
+        {
+            int64_t budget = requestBudgetMs(req);
+            auto limit = budget > 0 ? std::min(timeout, std::chrono::milliseconds(budget)) : timeout;
+            deadline = std::make_shared<RequestDeadline>(std::chrono::steady_clock::now() + limit);
+        }
 
-        const char* title = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
-        book["title"] = title ? title : "";
+        if (!lane.submit([handler, deadline, permit, &req, &res, args...]() mutable
+                         {
+                             if (!deadline)
+                             {
+                                 handler(req, res, args...);
+                             }
+                             else
+                             {
+                                 crow::response written;
+                                 if (deadline->passed())
+                                 {
+                                     deadline->expire(); // spent all its time in the queue
+                                 }
+                                 else
+                                 {
+                                     ScopedDeadline scope(deadline.get());
+                                     handler(req, written, args...);
+                                 }
+                                 finishResponse(res, written, deadline.get());
+                             }
+                             permit.reset(); }))
+        {
+            permit->cancel();
+            res = serviceUnavailable();
+            res.end();
+        }
+    };
+}
 
-        const char* summary = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-        book["summary"] = summary ? summary : "";
+// the query parameters a route reads, parsed the way its handler parses them
+//
+// part of the coalescing and cache keys, so parameters the route ignores, their
+// order or spelling ( limit=010 ) cannot split one response into many entries
+using QueryKey = std::string (*)(const crow::request &);
 
-        const char* image = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-        book["image"] = image ? image : "";
+static std::string noQuery(const crow::request &)
+{
+    return "";
+}
 
-        books[index++] = std::move(book);
+// /books: ?fields= and ?summary_max=
+static std::string bookListingQuery(const crow::request &req)
+{
+    unsigned fields = kAllBookFields;
+    const char *fields_param = req.url_params.get("fields");
+    if (fields_param && !parseBookFields(fields_param, fields))
+    {
+        return "fields=invalid";
     }
+    return "fields=" + std::to_string(fields) + "&summary_max=" + std::to_string(intParam(req, "summary_max", kSummaryDefaultMax, 0, 1000000));
+}
 
-    sqlite3_finalize(stmt);
-    sqlite3_close(db);
+// /reviews: ?book_ids= ( in the order given, the response follows it ) and ?limit_per_book=
+static std::string reviewBatchQuery(const crow::request &req)
+{
+    std::vector<int> book_ids;
+    if (!parseIdList(req.url_params.get("book_ids"), 100, book_ids))
+    {
+        return "book_ids=invalid";
+    }
+    std::string query = "book_ids=";
+    for (size_t i = 0; i < book_ids.size(); ++i)
+    {
+        query += (i ? "," : "") + std::to_string(book_ids[i]);
+    }
+    return query + "&limit_per_book=" + std::to_string(intParam(req, "limit_per_book", 10, 1, static_cast<int>(kReviewCacheDepth)));
+}
 
-    res.set_header("Content-Type", "application/json");
-    res.code = 200;
-    res.write(books.dump());
-    res.end(); });
+// /books/<int>: ?limit=
+static std::string bookDetailQuery(const crow::request &req)
+{
+    return "limit=" + std::to_string(intParam(req, "limit", 10, 1, 100));
+}
 
-    // getting all reviews on a book
-    CROW_ROUTE(app, "/books/<int>/reviews").methods(crow::HTTPMethod::GET)([](const crow::request &req, crow::response &res, int book_id)
-                                                                           {
-            sqlite3* db = openDB("book_review.sqlite");
-            if (!db) {
-                res.code = 500;
-                res.write("database error");
-                res.end();
-                return;
+// path, normalized query and negotiated encoding
+static std::string responseKey(const crow::request &req, QueryKey query)
+{
+    return req.url + '?' + query(req) + '|' + formatContentType(negotiateFormat(req.get_header_value("Accept")));
+}
+
+// a finished response, handed to every request that joined its computation
+struct SharedResponse
+{
+    int code;
+    crow::ci_map headers;
+    std::string body;
+};
+
+// coalescing identical concurrent requests to a route: one runs the handler, the others get its bytes
+//
+// identical means the same responseKey: path, the query parameters the route
+// reads and the negotiated encoding. successes and client errors ( a 400 for
+// a bad parameter is the same for every identical request ) are handed on. a
+// server error ( a 500 when a query fails ) or a result cut short by its
+// deadline is not; the requests that waited for it run the handler
+// themselves. a request waits for another one's result only until its own
+// deadline, then gets a 504
+template <class... Args, class Handler>
+static std::function<void(const crow::request &, crow::response &, Args...)> coalesce(const std::string &route, QueryKey query, Handler handler)
+{
+    auto flights = std::make_shared<SingleFlight<SharedResponse>>();
+    metrics::Counter &executed = metrics::counter("singleflight_executions_total{route=\"" + route + "\"}", "handler runs by coalescing leaders");
+    metrics::Counter &collapsed = metrics::counter("singleflight_collapsed_total{route=\"" + route + "\"}", "requests answered with another request's result");
+    metrics::Counter &gaveUp = metrics::counter("singleflight_wait_timeouts_total{route=\"" + route + "\"}", "requests whose deadline passed while waiting for another request's result");
+
+    return [flights, query, handler, &executed, &collapsed, &gaveUp](const crow::request &req, crow::response &res, Args... args)
+    {
+        std::string key = responseKey(req, query);
+        auto until = currentDeadline ? currentDeadline->at() : std::chrono::steady_clock::now() + kReadDeadline;
+        crow::response own;
+        FlightRole role;
+        auto result = flights->run(key, until, [&]() -> std::shared_ptr<const SharedResponse>
+                                   {
+            handler(req, own, args...);
+            if (own.code >= 500 || (currentDeadline && currentDeadline->outcome() != RequestDeadline::Outcome::Running))
+            {
+                return nullptr;
             }
-    
-            const char* sql = R"(
-                SELECT r.id, r.rating, r.comment, u.username
-                FROM reviews r
-                JOIN users u ON r.user_id = u.id
-                WHERE r.book_id = ?;
-            )";
-    
-            sqlite3_stmt* stmt = nullptr;
-            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-                sqlite3_close(db);
-                res.code = 500;
-                res.write("failed to prepare statement");
-                res.end();
-                return;
+            return std::make_shared<const SharedResponse>(SharedResponse{own.code, own.headers, own.body}); }, role);
+
+        if (role == FlightRole::Led)
+        {
+            executed.inc();
+            res.code = own.code;
+            res.headers = std::move(own.headers);
+            res.body = std::move(own.body);
+            return res.end();
+        }
+        if (role == FlightRole::GaveUp)
+        {
+            gaveUp.inc();
+            if (currentDeadline)
+            {
+                currentDeadline->expire(); // finishResponse answers 504 and counts it
             }
-    
-            sqlite3_bind_int(stmt, 1, book_id);
-    
-            crow::json::wvalue reviews = crow::json::wvalue::list();
-            int index = 0;
-    
-            while (sqlite3_step(stmt) == SQLITE_ROW) {
-                crow::json::wvalue review;
-                review["id"] = sqlite3_column_int(stmt, 0);
+            res.code = 504;
+            res.write("request timed out");
+            return res.end();
+        }
+        if (!result)
+        {
+            return handler(req, res, args...);
+        }
+        collapsed.inc();
+        res.code = result->code;
+        res.headers = result->headers;
+        res.body = result->body;
+        res.end();
+    };
+}
 
-                review["rating"] = sqlite3_column_int(stmt, 1);
-    
-                const char* comment_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
-                review["comment"] = comment_text ? comment_text : "";
+static StaleWhileRevalidateCache<SharedResponse> responseCache;
+static Lane refreshLane("refresh", 64);
+
+// the cache tag of a book's review list, which review writes invalidate
+static std::string bookReviewsPath(int bookId)
+{
+    return "/books/" + std::to_string(bookId) + "/reviews";
+}
+
+// a writer that wants its next read to see the write sends X-Read-Your-Writes: 1
+static bool readYourWrites(const crow::request &req)
+{
+    return req.get_header_value("X-Read-Your-Writes") == "1";
+}
+
+// serving a route from the response cache, rebuilt in the background once stale
+//
+// entries are keyed by responseKey, like coalesce, and tagged with the request
+// path. a request with Cache-Control: no-cache skips the cache and stores what
+// it computed. X-Cache tells whether the body was a HIT, STALE or a MISS
+template <class... Args, class Handler>
+static std::function<void(const crow::request &, crow::response &, Args...)> staleWhileRevalidate(const std::string &route, std::chrono::seconds softTtl, std::chrono::seconds hardTtl, QueryKey query, Handler handler)
+{
+    metrics::Counter &hits = metrics::counter("response_cache_hits_total{route=\"" + route + "\",state=\"fresh\"}", "responses served from the stale-while-revalidate cache");
+    metrics::Counter &staleHits = metrics::counter("response_cache_hits_total{route=\"" + route + "\",state=\"stale\"}", "responses served from the stale-while-revalidate cache");
+    metrics::Counter &misses = metrics::counter("response_cache_misses_total{route=\"" + route + "\"}", "responses built while the client waited");
+    metrics::Counter &refreshes = metrics::counter("response_cache_refreshes_total{route=\"" + route + "\"}", "stale entries rebuilt in the background");
+
+    return [=, &hits, &staleHits, &misses, &refreshes](const crow::request &req, crow::response &res, Args... args)
+    {
+        std::string key = responseKey(req, query);
+        std::string tag = req.url;
+        auto lookup = responseCache.get(key, tag);
+        bool bypass = req.get_header_value("Cache-Control").find("no-cache") != std::string::npos;
+
+        if (lookup.value && !bypass)
+        {
+            if (lookup.refresh)
+            {
+                // the handler runs again on a copy of the request, after this one has been answered
+                auto request = std::make_shared<crow::request>(req);
+                uint64_t generation = lookup.generation;
+                bool queued = refreshLane.submit([=, &refreshes]()
+                                                 {
+                    crow::response fresh;
+                    handler(*request, fresh, args...);
+                    refreshes.inc();
+                    if (fresh.code == 200)
+                    {
+                        responseCache.put(key, tag, std::make_shared<const SharedResponse>(SharedResponse{fresh.code, fresh.headers, fresh.body}), generation, softTtl, hardTtl);
+                    }
+                    else
+                    {
+                        responseCache.refreshFailed(key);
+                    } });
+                if (!queued)
+                {
+                    responseCache.refreshFailed(key);
+                }
+            }
+            (lookup.stale ? staleHits : hits).inc();
+            res.code = lookup.value->code;
+            res.headers = lookup.value->headers;
+            res.body = lookup.value->body;
+            res.set_header("X-Cache", lookup.stale ? "STALE" : "HIT");
+            return res.end();
+        }
+
+        misses.inc();
+        crow::response own;
+        handler(req, own, args...);
+        bool complete = !currentDeadline || currentDeadline->outcome() == RequestDeadline::Outcome::Running;
+        if (own.code == 200 && complete)
+        {
+            responseCache.put(key, tag, std::make_shared<const SharedResponse>(SharedResponse{own.code, own.headers, own.body}), lookup.generation, softTtl, hardTtl);
+        }
+        else if (lookup.refresh)
+        {
+            responseCache.refreshFailed(key);
+        }
+        res.code = own.code;
+        res.headers = std::move(own.headers);
+        res.body = std::move(own.body);
+        res.set_header("X-Cache", "MISS");
+        res.end();
+    };
+}
+
+static HotBooks hotBooks;
+static const char *kHotBooksPath = "book_review.hot";
+
+// counting a request for the hot books list, before any cache can answer it
+//
+// requests the server makes itself ( prewarming, no client address ) are not
+// counted: replaying last run's hot list must not make it hotter
+template <class Handler>
+static std::function<void(const crow::request &, crow::response &, int)> countBookHits(Handler handler)
+{
+    return [handler](const crow::request &req, crow::response &res, int book_id)
+    {
+        if (!req.remote_ip_address.empty())
+        {
+            hotBooks.record(book_id);
+        }
+        handler(req, res, book_id);
+    };
+}
+
+// the same for a handler that returns its response
+//
+template <class Respond>
+static void respondOnLane(Lane &lane, ConcurrencyLimiter &limiter, const crow::request &req, crow::response &res, Respond respond)
+{
+    auto permit = admit(limiter, req);
+    if (!permit)
+    {
+        res = serviceUnavailable();
+        return res.end();
+    }
+
+    if (!lane.submit([&res, respond, permit]() mutable
+                     {
+                         res = respond();
+                         res.end();
+                         permit.reset(); }))
+    {
+        permit->cancel();
+        res = serviceUnavailable();
+        res.end();
+    }
+}
+
+// bulk catalog import from a request body, for an admin already verified
+//
+static void importCatalog(const crow::request &req, crow::response &res)
+{
+    const char *format = req.url_params.get("format");
+    ImportFormat importFormat = importFormatFor(format ? format : "", req.get_header_value("Content-Type"));
+
+    // crow hands over the body fully read, so over http the upload is in memory once ( read
+    // in place, not copied ); files larger than memory go through `backend import <file>`, which streams
+    MemoryStreamBuf buf(req.body);
+    std::istream in(&buf);
+    ImportStats stats = importBooks("book_review.sqlite", in, importFormat);
+    if (stats.inserted > 0 && readYourWrites(req))
+    {
+        responseCache.invalidate("/books", true);
+    }
+
+    res.set_header("Content-Type", "application/json");
+    res.code = stats.inserted > 0 || stats.parsed == 0 ? 200 : 400;
+    res.write(importStatsToJson(stats).dump());
+    res.end();
+}
+
+// main
+int main(int argc, char *argv[])
+{
+    // init db
+    if (!createDBAndTables("book_review.sqlite"))
+    {
+        return 1;
+    }
+
+    if (argc > 1 && std::string(argv[1]) == "import")
+    {
+        return runImportCommand(argc, argv);
+    }
+
+    // bcrypt cost for this machine: BCRYPT_BUDGET_MS per login with BCRYPT_CONCURRENCY logins at once
+    passwordCost = calibratePasswordCost(envInt("BCRYPT_BUDGET_MS", kBcryptDefaultBudgetMs),
+                                         envInt("BCRYPT_CONCURRENCY", static_cast<int>(std::max(1u, std::thread::hardware_concurrency()))));
+    metrics::gauge("bcrypt_cost", "bcrypt work factor for new hashes").set(passwordCost);
+    std::cout << "bcrypt cost " << passwordCost << std::endl;
+
+    // autocomplete index, kept current by catalog and review writes
+    titleSuggest.build("book_review.sqlite");
+    catalog::onBooksChanged([]()
+                            { titleSuggest.onBooksChanged(); });
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { titleSuggest.onReviewChanged(change); });
+    titleSuggest.startRefresher("book_review.sqlite", std::chrono::seconds(5));
+
+    // fuzzy title index, rebuilt in the background after catalog writes
+    trigramIndex.build("book_review.sqlite");
+    catalog::onBooksChanged([]()
+                            { trigramIndex.onBooksChanged(); });
+    trigramIndex.startRebuilder("book_review.sqlite");
+
+    // leaderboards, adjusted on every review write
+    leaderboard.rebuild("book_review.sqlite");
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { leaderboard.onReviewChanged(change); });
+
+    // item-item similarity, recomputed in the background as reviews arrive
+    itemSimilarity.start("book_review.sqlite", std::chrono::seconds(2));
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { itemSimilarity.onReviewChanged(change); });
+
+    // personalized recommendations, retrained in the background at most every 10 minutes
+    recommender.start("book_review.sqlite", std::chrono::minutes(10));
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { recommender.onReviewChanged(change); });
+
+    // reviews written before timestamps existed, filled in a batch at a time
+    timestampBackfill.start("book_review.sqlite");
+
+    // trending books, decayed scores adjusted on every review write
+    trending.load("book_review.sqlite", unixNow());
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { trending.onReviewChanged(change); });
+
+    // review ownership per user, for edit and delete
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { reviewOwnership.onReviewChanged(change); });
+
+    // change log for /sync, trimmed to the retention window every hour
+    changeLogPruner.start("book_review.sqlite", std::chrono::hours(1));
+
+    // offline catalog bundle for /snapshot, rebuilt every 10 minutes when the catalog changed
+    catalogSnapshot.start("book_review.sqlite", std::chrono::minutes(10));
+
+    // live review events for /books/<int>/reviews/stream
+    reviewEvents.start();
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { reviewEvents.onReviewChanged(change); });
+
+    // cached /books and /books/<int>/reviews responses, stale after writes and rebuilt on the refresh lane
+    refreshLane.start(1);
+    catalog::onBooksChanged([]()
+                            { responseCache.invalidate("/books", false); });
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { responseCache.invalidate(bookReviewsPath(change.book_id), false); });
+
+    // newest reviews per book, dropped on review writes
+    catalog::onReviewChanged([](const catalog::ReviewChange &change)
+                             { reviewLists.onReviewChanged(change); });
+
+    // lane threads: one writer, since sqlite takes one write at a time, and half the cores for bcrypt
+    writeLane.start(1);
+    authLane.start(std::max(1u, std::thread::hardware_concurrency() / 2));
+
+    // taken usernames and emails, so duplicate registrations skip bcrypt
+    registrationFilter.load("book_review.sqlite");
+    registrationFilter.start();
+
+    // crow backend
+
+    crow::SimpleApp app;
+
+    // defining an endpoint in the root dir
+    CROW_ROUTE(app, "/")([]()
+                         { return "Book review backend is running!!"; });
+
+    // registration
+    CROW_ROUTE(app, "/register").methods(crow::HTTPMethod::POST)([](const crow::request &req, crow::response &res)
+                                                                 {
+        int64_t retryAfter = 0;
+        if (!admitClient("/register", "ip", req.remote_ip_address, kRegisterLimits.perIp, retryAfter)) {
+            res = tooManyRequests(retryAfter);
+            res.end();
+            return;
+        }
+
+        // parsing and bcrypt run on the auth lane, this thread goes back to serving reads
+        respondOnLane(authLane, routeLimiter("/register", kAuthLatencyTarget), req, res, [&req]()
+                      {
+        int64_t retryAfter = 0;
+        auto body = crow::json::load(req.body);
+        if (!body) return crow::response(400, "Invalid JSON");
+
+        std::string username = body["username"].s();
+        std::string email = body["email"].s();
+        std::string password = body["password"].s();
+
+        if (username.empty() || email.empty() || password.empty()) {
+            return crow::response(400, "Missing username or password");
+        }
+        if (!admitClient("/register", "user", username, kRegisterLimits.perUser, retryAfter)) {
+            return tooManyRequests(retryAfter);
+        }
+
+        static metrics::Counter &avoided = metrics::counter("register_bcrypt_avoided_total", "duplicate registrations refused before hashing");
+        static metrics::Counter &falsePositives = metrics::counter("register_filter_false_positives_total", "registration filter hits that were not taken");
+        static metrics::Summary &hashSeconds = metrics::summary("bcrypt_hash_seconds", "time spent hashing passwords");
+
+        // the filter rules out most new users without a query; a hit is confirmed before refusing
+        if (registrationFilter.mightBeTaken(username, email)) {
+            sqlite3 *db;
+            if (sqlite3_open("book_review.sqlite", &db) != SQLITE_OK) {
+                sqlite3_close(db);
+                return crow::response(500, "failed to open database.");
+            }
+            sqlite3_busy_timeout(db, 5000);
+            bool taken = userExists(db, username, email);
+            sqlite3_close(db);
+            if (taken) {
+                avoided.inc();
+                return crow::response(400, "User already exists");
+            }
+            falsePositives.inc();
+        }
+
+        auto hashStart = std::chrono::steady_clock::now();
+        std::string hashed = hashPassword(password); 
+        hashSeconds.observe(std::chrono::duration<double>(std::chrono::steady_clock::now() - hashStart).count());
+        
+        if (!storeUser(username, email, hashed)) {
+            return crow::response(400, "User already exists");
+        }
+        registrationFilter.add(username, email);
+
+        // create user
+        return crow::response(200, "User registered"); }); });
+
+    // login
+    CROW_ROUTE(app, "/login").methods(crow::HTTPMethod::POST)([](const crow::request &req, crow::response &res)
+                                                              {
+        int64_t retryAfter = 0;
+        if (!admitClient("/login", "ip", req.remote_ip_address, kLoginLimits.perIp, retryAfter)) {
+            res = tooManyRequests(retryAfter);
+            res.end();
+            return;
+        }
+
+        // parsing and bcrypt run on the auth lane, this thread goes back to serving reads
+        respondOnLane(authLane, routeLimiter("/login", kAuthLatencyTarget), req, res, [&req]()
+                      {
+        int64_t retryAfter = 0;
+        auto body = crow::json::load(req.body);
+        if (!body) return crow::response(400, "Invalid JSON");
+
+        std::string username = body["username"].s();
+        std::string password = body["password"].s();
+
+        if (username.empty() || password.empty()) {
+            return crow::response(400, "Missing username or password");
+        }
+        // per account, so guessing one password from many addresses is throttled too
+        if (!admitClient("/login", "user", username, kLoginLimits.perUser, retryAfter)) {
+            return tooManyRequests(retryAfter);
+        }
+
+        if (verifyUser(username, password)) {
+            return crow::response(200, "Login successful");
+        } else {
+            return crow::response(401, "Invalid username or password");
+        } }); });
+
+    // getting all books
+    CROW_ROUTE(app, "/books").methods(crow::HTTPMethod::GET)(onLane<>(readLane, routeLimiter("/books", kReadLatencyTarget), kReadDeadline, staleWhileRevalidate<>("/books", std::chrono::seconds(30), std::chrono::seconds(600), bookListingQuery, coalesce<>("/books", bookListingQuery, [](const crow::request &req, crow::response &res)
+                                                             {
+    // ?fields=id,title,image picks columns, ?summary_max= truncates summaries ( 0 for full text )
+    unsigned fields = kAllBookFields;
+    const char* fields_param = req.url_params.get("fields");
+    if (fields_param && !parseBookFields(fields_param, fields)) {
+        res.code = 400;
+        res.write("fields must be a comma separated list of id, title, image, summary");
+        res.end();
+        return;
+    }
+    int summary_max = intParam(req, "summary_max", kSummaryDefaultMax, 0, 1000000);
+    ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+
+    sqlite3* db = openDB("book_review.sqlite");
+    if (!db) {
+        res.code = 500;
+        res.write("failed to open database.");
+        res.end();
+        return;
+    }
+
+    std::string sql = bookListingSql(fields, summary_max);
+    sqlite3_stmt* stmt = nullptr;
+
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK) {
+        sqlite3_close(db);
+        res.code = 500;
+        res.write("failed to prepare statement.");
+        res.end();
+        return;
+    }
+
+    bool ok = false;
+    std::string body = encodeBody(format, [&](auto &writer)
+                                  { ok = writeBookRows(fields, stmt, writer); });
+
+    sqlite3_finalize(stmt);
+    sqlite3_close(db);
+
+    if (!ok) {
+        res.code = 500;
+        res.write("failed to read books.");
+        res.end();
+        return;
+    }
+
+    writeEncoded(res, format, body);
+    res.end(); }))));
+
+    // getting all reviews on a book
+    CROW_ROUTE(app, "/books/<int>/reviews").methods(crow::HTTPMethod::GET)(onLane<int>(readLane, routeLimiter("/books/<int>/reviews", kReadLatencyTarget), kReadDeadline, countBookHits(staleWhileRevalidate<int>("/books/<int>/reviews", std::chrono::seconds(5), std::chrono::seconds(300), noQuery, coalesce<int>("/books/<int>/reviews", noQuery, [](const crow::request &req, crow::response &res, int book_id)
+                                                                           {
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db) {
+                res.code = 500;
+                res.write("database error");
+                res.end();
+                return;
+            }
     
-                const char* username_text = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 3));
-                review["username"] = username_text ? username_text : "";
+            const char* sql = R"(
+                SELECT r.id, r.rating, r.comment, u.username
+                FROM reviews r
+                JOIN users u ON r.user_id = u.id
+                WHERE r.book_id = ?;
+            )";
     
-                reviews[index++] = std::move(review);
+            sqlite3_stmt* stmt = nullptr;
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
+                sqlite3_close(db);
+                res.code = 500;
+                res.write("failed to prepare statement");
+                res.end();
+                return;
             }
     
+            sqlite3_bind_int(stmt, 1, book_id);
+    
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginArray();
+                while (sqlite3_step(stmt) == SQLITE_ROW) {
+                    writeReview(writer, sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1), columnText(stmt, 2), columnText(stmt, 3));
+                }
+                writer.endArray(); });
+    
             sqlite3_finalize(stmt);
             sqlite3_close(db);
     
-            res.set_header("Content-Type", "application/json");
-            res.code = 200;
-            res.write(reviews.dump());
-            res.end(); });
+            writeEncoded(res, format, body);
+            res.end(); })))));
 
     // post a review on a selected book
-    CROW_ROUTE(app, "/books/<int>/review").methods(crow::HTTPMethod::POST)([](const crow::request &req, crow::response &res, int book_id)
+    CROW_ROUTE(app, "/books/<int>/review").methods(crow::HTTPMethod::POST)(onLane<int>(writeLane, routeLimiter("/books/<int>/review", kWriteLatencyTarget), kNoDeadline, [](const crow::request &req, crow::response &res, int book_id)
                                                                            {
             auto body = crow::json::load(req.body);
             if (!body)
@@ -392,7 +1260,7 @@ int main()
             int user_id = sqlite3_column_int(stmt, 0);
             sqlite3_finalize(stmt);
     
-            const char* sql_insert = "INSERT INTO reviews (user_id, book_id, rating, comment) VALUES (?, ?, ?, ?);";
+            const char* sql_insert = "INSERT INTO reviews (user_id, book_id, rating, comment, created_at, updated_at) VALUES (?, ?, ?, ?, ?, ?);";
             if (sqlite3_prepare_v2(db, sql_insert, -1, &stmt, nullptr) != SQLITE_OK)
             {
                 sqlite3_close(db);
@@ -405,8 +1273,12 @@ int main()
             sqlite3_bind_int(stmt, 2, book_id);
             sqlite3_bind_int(stmt, 3, rating);
             sqlite3_bind_text(stmt, 4, comment.c_str(), -1, SQLITE_TRANSIENT);
+            int64_t now = unixNow();
+            sqlite3_bind_int64(stmt, 5, now);
+            sqlite3_bind_int64(stmt, 6, now);
     
             rc = sqlite3_step(stmt);
+            int review_id = static_cast<int>(sqlite3_last_insert_rowid(db));
             sqlite3_finalize(stmt);
             sqlite3_close(db);
     
@@ -416,13 +1288,19 @@ int main()
                 res.write("failed to add review");
                 return res.end();
             }
+
+            catalog::notifyReviewChanged({catalog::ReviewChange::Kind::Added, review_id, book_id, user_id, rating, 0, now, username, comment});
+            if (readYourWrites(req))
+            {
+                responseCache.invalidate(bookReviewsPath(book_id), true);
+            }
     
             res.code = 200;
             res.write("review added successfully");
-            return res.end(); });
+            return res.end(); }));
 
     // editing review
-    CROW_ROUTE(app, "/reviews/<int>/edit").methods(crow::HTTPMethod::PUT)([](const crow::request &req, crow::response &res, int review_id)
+    CROW_ROUTE(app, "/reviews/<int>/edit").methods(crow::HTTPMethod::PUT)(onLane<int>(writeLane, routeLimiter("/reviews/<int>/edit", kWriteLatencyTarget), kNoDeadline, [](const crow::request &req, crow::response &res, int review_id)
                                                                           {
             auto body = crow::json::load(req.body);
             if (!body)
@@ -474,27 +1352,18 @@ int main()
             int user_id = sqlite3_column_int(stmt, 0);
             sqlite3_finalize(stmt);
     
-            const char* sql_check = "SELECT user_id FROM reviews WHERE id = ?;";
-            if (sqlite3_prepare_v2(db, sql_check, -1, &stmt, nullptr) != SQLITE_OK)
-            {
-                sqlite3_close(db);
-                res.code = 500;
-                res.write("failed to prepare ownership check");
-                return res.end();
-            }
-    
-            sqlite3_bind_int(stmt, 1, review_id);
-            if (sqlite3_step(stmt) != SQLITE_ROW || sqlite3_column_int(stmt, 0) != user_id)
+            OwnedReview owned;
+            if (!reviewOwnership.find(db, user_id, review_id, owned))
             {
-                sqlite3_finalize(stmt);
                 sqlite3_close(db);
                 res.code = 403;
                 res.write("forbidden: Not your review");
                 return res.end();
             }
-            sqlite3_finalize(stmt);
+            int review_book_id = owned.book_id;
+            int old_rating = owned.rating;
     
-            const char* sql_update = "UPDATE reviews SET rating = ?, comment = ? WHERE id = ?;";
+            const char* sql_update = "UPDATE reviews SET rating = ?, comment = ?, updated_at = ? WHERE id = ? AND user_id = ?;";
             if (sqlite3_prepare_v2(db, sql_update, -1, &stmt, nullptr) != SQLITE_OK)
             {
                 sqlite3_close(db);
@@ -505,9 +1374,13 @@ int main()
     
             sqlite3_bind_int(stmt, 1, rating);
             sqlite3_bind_text(stmt, 2, comment.c_str(), -1, SQLITE_TRANSIENT);
-            sqlite3_bind_int(stmt, 3, review_id);
+            int64_t now = unixNow();
+            sqlite3_bind_int64(stmt, 3, now);
+            sqlite3_bind_int(stmt, 4, review_id);
+            sqlite3_bind_int(stmt, 5, user_id);
     
             int rc = sqlite3_step(stmt);
+            int changed = sqlite3_changes(db);
             sqlite3_finalize(stmt);
             sqlite3_close(db);
     
@@ -517,13 +1390,25 @@ int main()
                 res.write("failed to update review");
                 return res.end();
             }
+            if (changed == 0)
+            {
+                res.code = 403; // deleted since the ownership lookup
+                res.write("forbidden: Not your review");
+                return res.end();
+            }
+
+            catalog::notifyReviewChanged({catalog::ReviewChange::Kind::Edited, review_id, review_book_id, user_id, rating, old_rating, now, username, comment});
+            if (readYourWrites(req))
+            {
+                responseCache.invalidate(bookReviewsPath(review_book_id), true);
+            }
     
             res.code = 200;
             res.write("review updated successfully");
-            return res.end(); });
+            return res.end(); }));
 
     // deleting review
-    CROW_ROUTE(app, "/reviews/<int>/delete").methods(crow::HTTPMethod::DELETE)([](const crow::request &req, crow::response &res, int review_id)
+    CROW_ROUTE(app, "/reviews/<int>/delete").methods(crow::HTTPMethod::DELETE)(onLane<int>(writeLane, routeLimiter("/reviews/<int>/delete", kWriteLatencyTarget), kNoDeadline, [](const crow::request &req, crow::response &res, int review_id)
                                                                                {
             auto body = crow::json::load(req.body);
             if (!body)
@@ -574,28 +1459,20 @@ int main()
             sqlite3_finalize(stmt);
     
             // Check ownership
-            const char* sql_check = "SELECT user_id FROM reviews WHERE id = ?;";
-            if (sqlite3_prepare_v2(db, sql_check, -1, &stmt, nullptr) != SQLITE_OK)
-            {
-                sqlite3_close(db);
-                res.code = 500;
-                res.write("failed to prepare ownership check");
-                return res.end();
-            }
-    
-            sqlite3_bind_int(stmt, 1, review_id);
-            if (sqlite3_step(stmt) != SQLITE_ROW || sqlite3_column_int(stmt, 0) != user_id)
+            OwnedReview owned;
+            if (!reviewOwnership.find(db, user_id, review_id, owned))
             {
-                sqlite3_finalize(stmt);
                 sqlite3_close(db);
                 res.code = 403;
                 res.write("forbidden: Not your review");
                 return res.end();
             }
-            sqlite3_finalize(stmt);
+            int review_book_id = owned.book_id;
+            int old_rating = owned.rating;
+            int64_t created_at = owned.created_at;
     
             // Delete review
-            const char* sql_delete = "DELETE FROM reviews WHERE id = ?;";
+            const char* sql_delete = "DELETE FROM reviews WHERE id = ? AND user_id = ?;";
             if (sqlite3_prepare_v2(db, sql_delete, -1, &stmt, nullptr) != SQLITE_OK)
             {
                 sqlite3_close(db);
@@ -605,7 +1482,9 @@ int main()
             }
     
             sqlite3_bind_int(stmt, 1, review_id);
+            sqlite3_bind_int(stmt, 2, user_id);
             int rc = sqlite3_step(stmt);
+            int changed = sqlite3_changes(db);
             sqlite3_finalize(stmt);
             sqlite3_close(db);
     
@@ -615,11 +1494,1036 @@ int main()
                 res.write("failed to delete review");
                 return res.end();
             }
+            if (changed == 0)
+            {
+                res.code = 403; // deleted since the ownership lookup
+                res.write("forbidden: Not your review");
+                return res.end();
+            }
+
+            catalog::notifyReviewChanged({catalog::ReviewChange::Kind::Deleted, review_id, review_book_id, user_id, old_rating, 0, created_at, username, ""});
+            if (readYourWrites(req))
+            {
+                responseCache.invalidate(bookReviewsPath(review_book_id), true);
+            }
     
             res.code = 200;
             res.write("review deleted successfully");
-            return res.end(); });
+            return res.end(); }));
 
-    // set the port, set the app to run on multiple threads, and run the app
-    app.bindaddr("0.0.0.0").port(18080).run();
+    // full-text search over books and reviews: /search?q=&scope=books|reviews|all&limit=&offset=
+    // mode=fuzzy matches misspelled titles by trigram similarity instead
+    CROW_ROUTE(app, "/search").methods(crow::HTTPMethod::GET)(onLane<>(readLane, routeLimiter("/search", kReadLatencyTarget), kReadDeadline, [](const crow::request &req, crow::response &res)
+                                                             {
+            const char* q = req.url_params.get("q");
+            const char* mode = req.url_params.get("mode");
+
+            if (mode && std::string(mode) == "fuzzy")
+            {
+                int limit = intParam(req, "limit", kSearchDefaultLimit, 1, static_cast<int>(kFuzzyMaxLimit));
+                int offset = intParam(req, "offset", 0, 0, 1000);
+                if (!q || !*q)
+                {
+                    res.code = 400;
+                    res.write("missing search query");
+                    return res.end();
+                }
+
+                auto matches = trigramIndex.search(q, limit, offset);
+                ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+                std::string body = encodeBody(format, [&](auto &writer)
+                                              {
+                    writer.beginObject(5);
+                    writer.key("query");
+                    writer.string(q);
+                    writer.key("mode");
+                    writer.string("fuzzy");
+                    writer.key("limit");
+                    writer.integer(limit);
+                    writer.key("offset");
+                    writer.integer(offset);
+                    writer.key("books");
+                    writer.beginArray();
+                    for (const auto &match : matches)
+                    {
+                        writer.beginObject(3);
+                        writer.key("id");
+                        writer.integer(match.bookId);
+                        writer.key("title");
+                        writer.string(match.title.data(), match.title.size());
+                        writer.key("similarity");
+                        writer.number(match.similarity);
+                        writer.endObject();
+                    }
+                    writer.endArray();
+                    writer.endObject(); });
+
+                writeEncoded(res, format, body);
+                return res.end();
+            }
+
+            std::string match = buildMatchQuery(q ? q : "");
+            if (match.empty())
+            {
+                res.code = 400;
+                res.write("missing search query");
+                return res.end();
+            }
+
+            const char* scopeParam = req.url_params.get("scope");
+            std::string scope = scopeParam ? scopeParam : "all";
+            if (scope != "all" && scope != "books" && scope != "reviews")
+            {
+                res.code = 400;
+                res.write("scope must be books, reviews or all");
+                return res.end();
+            }
+
+            int limit = intParam(req, "limit", kSearchDefaultLimit, 1, kSearchMaxLimit);
+            int offset = intParam(req, "offset", 0, 0, 1000000);
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            bool ok = true;
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginObject(3 + (scope != "reviews") + (scope != "books"));
+                writer.key("query");
+                writer.string(q);
+                writer.key("limit");
+                writer.integer(limit);
+                writer.key("offset");
+                writer.integer(offset);
+                if (scope != "reviews")
+                    ok = searchBooks(db, match, limit, offset, writer) && ok;
+                if (scope != "books")
+                    ok = searchReviews(db, match, limit, offset, writer) && ok;
+                writer.endObject(); });
+
+            sqlite3_close(db);
+
+            if (!ok)
+            {
+                res.code = 500;
+                res.write("search failed");
+                return res.end();
+            }
+
+            writeEncoded(res, format, body);
+            return res.end(); }));
+
+    // title autocomplete: /books/suggest?prefix=&limit=
+    CROW_ROUTE(app, "/books/suggest").methods(crow::HTTPMethod::GET)([](const crow::request &req, crow::response &res)
+                                                                    {
+            const char* prefix = req.url_params.get("prefix");
+            int limit = intParam(req, "limit", 10, 1, static_cast<int>(kSuggestMaxLimit));
+
+            auto matches = titleSuggest.suggest(prefix ? prefix : "", limit);
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginArray();
+                for (const auto &match : matches)
+                {
+                    writer.beginObject(3);
+                    writer.key("id");
+                    writer.integer(match.bookId);
+                    writer.key("title");
+                    writer.string(match.title.data(), match.title.size());
+                    writer.key("reviews");
+                    writer.integer(match.reviews);
+                    writer.endObject();
+                }
+                writer.endArray(); });
+
+            writeEncoded(res, format, body);
+            return res.end(); });
+
+    // best books: /books/top?by=avg|count&k=&bayesian=1
+    CROW_ROUTE(app, "/books/top").methods(crow::HTTPMethod::GET)(onLane<>(readLane, routeLimiter("/books/top", kReadLatencyTarget), kReadDeadline, [](const crow::request &req, crow::response &res)
+                                                                {
+            const char* by = req.url_params.get("by");
+            const char* bayesian = req.url_params.get("bayesian");
+            std::string order = by ? by : "avg";
+            if (order != "avg" && order != "count")
+            {
+                res.code = 400;
+                res.write("by must be avg or count");
+                return res.end();
+            }
+
+            LeaderboardOrder boardOrder = LeaderboardOrder::Count;
+            if (order == "avg")
+            {
+                boardOrder = bayesian && std::string(bayesian) != "0" ? LeaderboardOrder::Bayesian : LeaderboardOrder::Average;
+            }
+            int k = intParam(req, "k", 10, 1, static_cast<int>(kLeaderboardMaxK));
+            std::vector<LeaderboardEntry> entries = leaderboard.top(boardOrder, k);
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            std::vector<int> ids;
+            for (const auto &entry : entries)
+            {
+                ids.push_back(entry.bookId);
+            }
+            auto books = fetchBookCards(db, ids);
+            sqlite3_close(db);
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginArray();
+                for (const auto &entry : entries)
+                {
+                    auto book = books.find(entry.bookId);
+                    if (book == books.end())
+                    {
+                        continue; // reviews pointing at a missing book
+                    }
+                    writer.beginObject(6);
+                    writer.key("id");
+                    writer.integer(entry.bookId);
+                    writer.key("title");
+                    writer.string(book->second.first.data(), book->second.first.size());
+                    writer.key("image");
+                    writer.string(book->second.second.data(), book->second.second.size());
+                    writer.key("reviews");
+                    writer.integer(entry.count);
+                    writer.key("average");
+                    writer.number(entry.average);
+                    writer.key("score");
+                    writer.number(entry.score);
+                    writer.endObject();
+                }
+                writer.endArray(); });
+
+            writeEncoded(res, format, body);
+            return res.end(); }));
+
+    // readers also liked: /books/<int>/similar?k=
+    CROW_ROUTE(app, "/books/<int>/similar").methods(crow::HTTPMethod::GET)(onLane<int>(readLane, routeLimiter("/books/<int>/similar", kReadLatencyTarget), kReadDeadline, countBookHits([](const crow::request &req, crow::response &res, int book_id)
+                                                                           {
+            int k = intParam(req, "k", 10, 1, static_cast<int>(kSimilarNeighbors));
+            std::vector<SimilarBook> neighbors = itemSimilarity.similar(book_id, k);
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            std::vector<int> ids;
+            for (const auto &neighbor : neighbors)
+            {
+                ids.push_back(neighbor.bookId);
+            }
+            auto books = fetchBookCards(db, ids);
+            sqlite3_close(db);
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginArray();
+                for (const auto &neighbor : neighbors)
+                {
+                    auto book = books.find(neighbor.bookId);
+                    if (book == books.end())
+                    {
+                        continue;
+                    }
+                    writer.beginObject(4);
+                    writer.key("id");
+                    writer.integer(neighbor.bookId);
+                    writer.key("title");
+                    writer.string(book->second.first.data(), book->second.first.size());
+                    writer.key("image");
+                    writer.string(book->second.second.data(), book->second.second.size());
+                    writer.key("similarity");
+                    writer.number(neighbor.similarity);
+                    writer.endObject();
+                }
+                writer.endArray(); });
+
+            writeEncoded(res, format, body);
+            return res.end(); })));
+
+    // personalized recommendations: /users/<name>/recommendations?k=
+    CROW_ROUTE(app, "/users/<string>/recommendations").methods(crow::HTTPMethod::GET)(onLane<std::string>(readLane, routeLimiter("/users/<string>/recommendations", kReadLatencyTarget), kReadDeadline, [](const crow::request &req, crow::response &res, std::string username)
+                                                                                      {
+            int k = intParam(req, "k", 10, 1, static_cast<int>(kRecommendMaxK));
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            sqlite3_stmt* stmt;
+            const char* sql_user = "SELECT id FROM users WHERE username = ?;";
+            if (sqlite3_prepare_v2(db, sql_user, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                sqlite3_close(db);
+                res.code = 500;
+                res.write("failed to prepare user query");
+                return res.end();
+            }
+
+            sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(stmt) != SQLITE_ROW)
+            {
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+                res.code = 404;
+                res.write("user not found");
+                return res.end();
+            }
+            int user_id = sqlite3_column_int(stmt, 0);
+            sqlite3_finalize(stmt);
+
+            // books the user already reviewed are never recommended
+            std::unordered_set<int> reviewed;
+            const char* sql_reviewed = "SELECT book_id FROM reviews WHERE user_id = ?;";
+            if (sqlite3_prepare_v2(db, sql_reviewed, -1, &stmt, nullptr) == SQLITE_OK)
+            {
+                sqlite3_bind_int(stmt, 1, user_id);
+                while (sqlite3_step(stmt) == SQLITE_ROW)
+                {
+                    reviewed.insert(sqlite3_column_int(stmt, 0));
+                }
+            }
+            sqlite3_finalize(stmt);
+
+            std::vector<Recommendation> picks = recommender.recommend(user_id, reviewed, k);
+            std::vector<int> ids;
+            for (const auto &pick : picks)
+            {
+                ids.push_back(pick.bookId);
+            }
+            auto books = fetchBookCards(db, ids);
+            sqlite3_close(db);
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginArray();
+                for (const auto &pick : picks)
+                {
+                    auto book = books.find(pick.bookId);
+                    if (book == books.end())
+                    {
+                        continue;
+                    }
+                    writer.beginObject(4);
+                    writer.key("id");
+                    writer.integer(pick.bookId);
+                    writer.key("title");
+                    writer.string(book->second.first.data(), book->second.first.size());
+                    writer.key("image");
+                    writer.string(book->second.second.data(), book->second.second.size());
+                    writer.key("score");
+                    writer.number(pick.score);
+                    writer.endObject();
+                }
+                writer.endArray(); });
+
+            writeEncoded(res, format, body);
+            return res.end(); }));
+
+    // trending books, by reviews written recently ( half-life of three days ): /books/trending?k=
+    CROW_ROUTE(app, "/books/trending").methods(crow::HTTPMethod::GET)(onLane<>(readLane, routeLimiter("/books/trending", kReadLatencyTarget), kReadDeadline, [](const crow::request &req, crow::response &res)
+                                                                      {
+            int k = intParam(req, "k", 10, 1, static_cast<int>(kTrendingMaxK));
+            std::vector<TrendingBook> entries = trending.top(k, unixNow());
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            std::vector<int> ids;
+            for (const auto &entry : entries)
+            {
+                ids.push_back(entry.bookId);
+            }
+            auto books = fetchBookCards(db, ids);
+            sqlite3_close(db);
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginArray();
+                for (const auto &entry : entries)
+                {
+                    auto book = books.find(entry.bookId);
+                    if (book == books.end())
+                    {
+                        continue;
+                    }
+                    writer.beginObject(4);
+                    writer.key("id");
+                    writer.integer(entry.bookId);
+                    writer.key("title");
+                    writer.string(book->second.first.data(), book->second.first.size());
+                    writer.key("image");
+                    writer.string(book->second.second.data(), book->second.second.size());
+                    writer.key("score");
+                    writer.number(entry.score);
+                    writer.endObject();
+                }
+                writer.endArray(); });
+
+            writeEncoded(res, format, body);
+            return res.end(); }));
+
+    // reviews written by a user, newest first: /users/<string>/reviews?limit=&before=
+    // keyset pagination, pass the response's "next" as before= for the following page
+    CROW_ROUTE(app, "/users/<string>/reviews").methods(crow::HTTPMethod::GET)(onLane<std::string>(readLane, routeLimiter("/users/<string>/reviews", kReadLatencyTarget), kReadDeadline, [](const crow::request &req, crow::response &res, std::string username)
+                                                                              {
+            int limit = intParam(req, "limit", 20, 1, 100);
+            int before = intParam(req, "before", INT_MAX, 1, INT_MAX);
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            sqlite3_stmt* stmt;
+            const char* sql_user = "SELECT id FROM users WHERE username = ?;";
+            if (sqlite3_prepare_v2(db, sql_user, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                sqlite3_close(db);
+                res.code = 500;
+                res.write("failed to prepare user query");
+                return res.end();
+            }
+
+            sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+            if (sqlite3_step(stmt) != SQLITE_ROW)
+            {
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+                res.code = 404;
+                res.write("user not found");
+                return res.end();
+            }
+            int user_id = sqlite3_column_int(stmt, 0);
+            sqlite3_finalize(stmt);
+
+            // walks idx_reviews_user backwards from the cursor, one extra row to know if there is a next page
+            const char* sql = R"(
+                SELECT r.id, r.book_id, b.title, b.image_url, r.rating, r.comment, r.created_at, r.updated_at
+                FROM reviews r
+                JOIN books b ON b.id = r.book_id
+                WHERE r.user_id = ? AND r.id < ?
+                ORDER BY r.id DESC
+                LIMIT ?;
+            )";
+            if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                sqlite3_close(db);
+                res.code = 500;
+                res.write("failed to prepare statement");
+                return res.end();
+            }
+
+            sqlite3_bind_int(stmt, 1, user_id);
+            sqlite3_bind_int(stmt, 2, before);
+            sqlite3_bind_int(stmt, 3, limit + 1);
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                int index = 0;
+                int last_id = 0;
+                bool more = false;
+                writer.beginObject(2);
+                writer.key("reviews");
+                writer.beginArray();
+                while (sqlite3_step(stmt) == SQLITE_ROW)
+                {
+                    if (index == limit)
+                    {
+                        more = true;
+                        break;
+                    }
+                    last_id = sqlite3_column_int(stmt, 0);
+                    writer.beginObject(8);
+                    writer.key("id");
+                    writer.integer(last_id);
+                    writer.key("book_id");
+                    writer.integer(sqlite3_column_int(stmt, 1));
+                    std::string title = columnText(stmt, 2);
+                    writer.key("title");
+                    writer.string(title.data(), title.size());
+                    std::string image = columnText(stmt, 3);
+                    writer.key("image");
+                    writer.string(image.data(), image.size());
+                    writer.key("rating");
+                    writer.integer(sqlite3_column_int(stmt, 4));
+                    std::string comment = columnText(stmt, 5);
+                    writer.key("comment");
+                    writer.string(comment.data(), comment.size());
+                    writer.key("created_at");
+                    writer.integer(sqlite3_column_int64(stmt, 6));
+                    writer.key("updated_at");
+                    writer.integer(sqlite3_column_int64(stmt, 7));
+                    writer.endObject();
+                    ++index;
+                }
+                writer.endArray();
+                writer.key("next");
+                if (more)
+                {
+                    writer.integer(last_id);
+                }
+                else
+                {
+                    writer.null();
+                }
+                writer.endObject(); });
+            sqlite3_finalize(stmt);
+            sqlite3_close(db);
+
+            writeEncoded(res, format, body);
+            return res.end(); }));
+
+    // newest reviews for several books at once: /reviews?book_ids=1,2,3&limit_per_book=
+    // answers { "<book_id>": [ reviews, newest first ] }, cached books are not queried again
+    CROW_ROUTE(app, "/reviews").methods(crow::HTTPMethod::GET)(onLane<>(readLane, routeLimiter("/reviews", kReadLatencyTarget), kReadDeadline, coalesce<>("/reviews", reviewBatchQuery, [](const crow::request &req, crow::response &res)
+                                                              {
+            std::vector<int> book_ids;
+            if (!parseIdList(req.url_params.get("book_ids"), 100, book_ids))
+            {
+                res.code = 400;
+                res.write("book_ids must be 1 to 100 comma separated ids");
+                return res.end();
+            }
+            size_t limit = intParam(req, "limit_per_book", 10, 1, static_cast<int>(kReviewCacheDepth));
+
+            std::unordered_map<int, std::shared_ptr<const BookReviewList>> lists;
+            std::vector<int> missing;
+            for (int book_id : book_ids)
+            {
+                auto cached = reviewLists.get(book_id, limit);
+                if (cached)
+                {
+                    lists[book_id] = std::move(cached);
+                }
+                else
+                {
+                    missing.push_back(book_id);
+                }
+            }
+
+            if (!missing.empty())
+            {
+                sqlite3* db = openDB("book_review.sqlite");
+                if (!db)
+                {
+                    res.code = 500;
+                    res.write("database error");
+                    return res.end();
+                }
+
+                // one pass over idx_reviews_book for all missing books, cut per book by the window
+                std::string sql = R"(
+                    SELECT book_id, id, rating, comment, username FROM (
+                        SELECT r.book_id, r.id, r.rating, r.comment, u.username,
+                               ROW_NUMBER() OVER (PARTITION BY r.book_id ORDER BY r.id DESC) AS rn
+                        FROM reviews r
+                        JOIN users u ON u.id = r.user_id
+                        WHERE r.book_id IN ()";
+                for (size_t i = 0; i < missing.size(); ++i)
+                {
+                    sql += i == 0 ? "?" : ", ?";
+                }
+                sql += R"()
+                    )
+                    WHERE rn <= ?
+                    ORDER BY book_id, rn;
+                )";
+
+                sqlite3_stmt* stmt = nullptr;
+                if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) != SQLITE_OK)
+                {
+                    sqlite3_close(db);
+                    res.code = 500;
+                    res.write("failed to prepare statement");
+                    return res.end();
+                }
+
+                int param = 1;
+                for (int book_id : missing)
+                {
+                    sqlite3_bind_int(stmt, param++, book_id);
+                }
+                sqlite3_bind_int(stmt, param, static_cast<int>(kReviewCacheDepth));
+
+                // always reading the full cache depth, so the lists can be cached for any limit
+                uint64_t generation = reviewLists.generation();
+                std::unordered_map<int, BookReviewList> loaded;
+                for (int book_id : missing)
+                {
+                    loaded[book_id] = {{}, true};
+                }
+                int rc;
+                while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+                {
+                    BookReviewList &list = loaded[sqlite3_column_int(stmt, 0)];
+                    list.newest.push_back({sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2), columnText(stmt, 3), columnText(stmt, 4)});
+                }
+                sqlite3_finalize(stmt);
+                sqlite3_close(db);
+
+                if (rc != SQLITE_DONE)
+                {
+                    res.code = 500;
+                    res.write("failed to read reviews");
+                    return res.end();
+                }
+
+                for (auto &entry : loaded)
+                {
+                    entry.second.complete = entry.second.newest.size() < kReviewCacheDepth;
+                    lists[entry.first] = std::make_shared<const BookReviewList>(entry.second);
+                    reviewLists.put(entry.first, std::move(entry.second), generation);
+                }
+            }
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          {
+                writer.beginObject(book_ids.size());
+                for (int book_id : book_ids)
+                {
+                    const BookReviewList &list = *lists[book_id];
+                    writer.key(std::to_string(book_id).c_str());
+                    writer.beginArray();
+                    size_t count = std::min(limit, list.newest.size());
+                    for (size_t i = 0; i < count; ++i)
+                    {
+                        const CachedReview &cached = list.newest[i];
+                        writeReview(writer, cached.id, cached.rating, cached.comment, cached.username);
+                    }
+                    writer.endArray();
+                }
+                writer.endObject(); });
+
+            writeEncoded(res, format, body);
+            return res.end(); })));
+
+    // one book with its rating summary and first page of reviews: /books/<int>?limit=
+    // all read in one transaction, so the summary and the reviews agree
+    CROW_ROUTE(app, "/books/<int>").methods(crow::HTTPMethod::GET)(onLane<int>(readLane, routeLimiter("/books/<int>", kReadLatencyTarget), kReadDeadline, countBookHits(coalesce<int>("/books/<int>", bookDetailQuery, [](const crow::request &req, crow::response &res, int book_id)
+                                                                   {
+            int limit = intParam(req, "limit", 10, 1, 100);
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            if (sqlite3_exec(db, "BEGIN;", nullptr, 0, nullptr) != SQLITE_OK)
+            {
+                sqlite3_close(db);
+                res.code = 500;
+                res.write("failed to begin transaction");
+                return res.end();
+            }
+
+            // leaving the read transaction and the connection, whatever happened
+            auto finish = [&](sqlite3_stmt* stmt)
+            {
+                sqlite3_finalize(stmt);
+                sqlite3_exec(db, "COMMIT;", nullptr, 0, nullptr);
+                sqlite3_close(db);
+            };
+
+            sqlite3_stmt* stmt = nullptr;
+            const char* sql_book = "SELECT title, image_url, summary FROM books WHERE id = ?;";
+            if (sqlite3_prepare_v2(db, sql_book, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                finish(stmt);
+                res.code = 500;
+                res.write("failed to prepare book query");
+                return res.end();
+            }
+            sqlite3_bind_int(stmt, 1, book_id);
+            if (sqlite3_step(stmt) != SQLITE_ROW)
+            {
+                finish(stmt);
+                res.code = 404;
+                res.write("book not found");
+                return res.end();
+            }
+            crow::json::wvalue book;
+            book["id"] = book_id;
+            book["title"] = columnText(stmt, 0);
+            book["image"] = columnText(stmt, 1);
+            book["summary"] = columnText(stmt, 2);
+            sqlite3_finalize(stmt);
+            stmt = nullptr;
+
+            const char* sql_stats = "SELECT rating, COUNT(*) FROM reviews WHERE book_id = ? GROUP BY rating;";
+            if (sqlite3_prepare_v2(db, sql_stats, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                finish(stmt);
+                res.code = 500;
+                res.write("failed to prepare rating query");
+                return res.end();
+            }
+            sqlite3_bind_int(stmt, 1, book_id);
+            int64_t histogram[5] = {0, 0, 0, 0, 0};
+            int64_t count = 0, sum = 0;
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                int rating = sqlite3_column_int(stmt, 0);
+                int64_t n = sqlite3_column_int64(stmt, 1);
+                if (rating >= 1 && rating <= 5)
+                {
+                    histogram[rating - 1] = n;
+                }
+                count += n;
+                sum += rating * n;
+            }
+            sqlite3_finalize(stmt);
+            stmt = nullptr;
+
+            crow::json::wvalue stats;
+            stats["reviews"] = count;
+            stats["average"] = count ? static_cast<double>(sum) / count : 0.0;
+            for (int i = 0; i < 5; ++i)
+            {
+                stats["histogram"][i] = histogram[i];
+            }
+
+            const char* sql_reviews = R"(
+                SELECT r.id, r.rating, r.comment, u.username
+                FROM reviews r
+                JOIN users u ON r.user_id = u.id
+                WHERE r.book_id = ?
+                ORDER BY r.id DESC
+                LIMIT ?;
+            )";
+            if (sqlite3_prepare_v2(db, sql_reviews, -1, &stmt, nullptr) != SQLITE_OK)
+            {
+                finish(stmt);
+                res.code = 500;
+                res.write("failed to prepare reviews query");
+                return res.end();
+            }
+            sqlite3_bind_int(stmt, 1, book_id);
+            sqlite3_bind_int(stmt, 2, limit);
+            crow::json::wvalue reviews = crow::json::wvalue::list();
+            int index = 0;
+            while (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                crow::json::wvalue review;
+                review["id"] = sqlite3_column_int(stmt, 0);
+                review["rating"] = sqlite3_column_int(stmt, 1);
+                review["comment"] = columnText(stmt, 2);
+                review["username"] = columnText(stmt, 3);
+                reviews[index++] = std::move(review);
+            }
+            finish(stmt);
+
+            crow::json::wvalue detail;
+            detail["book"] = std::move(book);
+            detail["stats"] = std::move(stats);
+            detail["reviews"] = std::move(reviews);
+
+            res.set_header("Content-Type", "application/json");
+            res.code = 200;
+            res.write(detail.dump());
+            return res.end(); }))));
+
+    // live review events on a book, as server-sent events: /books/<int>/reviews/stream
+    // each response carries the pending events ( waiting up to 20s for one ) and ends, EventSource
+    // then reconnects with Last-Event-ID. "reset" means events were missed and the list should be refetched
+    CROW_ROUTE(app, "/books/<int>/reviews/stream").methods(crow::HTTPMethod::GET)([](const crow::request &req, crow::response &res, int book_id)
+                                                                                  {
+            std::string last_event_id = req.get_header_value("Last-Event-ID");
+            const char* last_param = req.url_params.get("last_event_id");
+            if (last_event_id.empty() && last_param)
+            {
+                last_event_id = last_param;
+            }
+
+            auto subscription = reviewEvents.subscribe(book_id, std::strtoull(last_event_id.c_str(), nullptr, 10));
+            bool reset = subscription.reset;
+            uint64_t last_id = subscription.lastId;
+            auto respond = [&res, reset, last_id](const std::vector<StreamFrame> &frames, bool waited)
+            {
+                std::string body = waited || reset ? "retry: 500\n\n" : "retry: 3000\n\n";
+                if (reset)
+                {
+                    body += "id: " + std::to_string(last_id) + "\nevent: reset\ndata: {}\n\n";
+                }
+                else if (frames.empty())
+                {
+                    body += "id: " + std::to_string(last_id) + "\n\n"; // moves the client's last id on without an event
+                }
+                for (const auto &frame : frames)
+                {
+                    body += *frame;
+                }
+
+                res.set_header("Content-Type", "text/event-stream");
+                res.set_header("Cache-Control", "no-cache");
+                res.code = 200;
+                res.write(body);
+                res.end();
+            };
+
+            // nothing to send yet: the request is parked, no thread waits with it, and the
+            // publisher or the bus's timer ends it. when too many are parked, clients poll slower
+            if (subscription.missed.empty() && !reset &&
+                reviewEvents.park(subscription.subscriber, std::chrono::seconds(20), [respond](std::vector<StreamFrame> frames)
+                                  { respond(frames, true); }))
+            {
+                return;
+            }
+            reviewEvents.unsubscribe(subscription.subscriber);
+            respond(subscription.missed, false); });
+
+    // what changed since a version: /sync?since=V
+    // compacted upserts and deletes per entity plus the new version, or everything when V is too old
+    CROW_ROUTE(app, "/sync").methods(crow::HTTPMethod::GET)(onLane<>(readLane, routeLimiter("/sync", kReadLatencyTarget), kReadDeadline, [](const crow::request &req, crow::response &res)
+                                                           {
+            const char* since_param = req.url_params.get("since");
+            int64_t since = since_param ? std::strtoll(since_param, nullptr, 10) : 0;
+
+            sqlite3* db = openDB("book_review.sqlite");
+            if (!db)
+            {
+                res.code = 500;
+                res.write("database error");
+                return res.end();
+            }
+
+            // version, deltas and rows all from one snapshot of the database
+            if (sqlite3_exec(db, "BEGIN;", nullptr, 0, nullptr) != SQLITE_OK)
+            {
+                sqlite3_close(db);
+                res.code = 500;
+                res.write("failed to begin transaction");
+                return res.end();
+            }
+
+            ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+            bool ok = false;
+            std::string body = encodeBody(format, [&](auto &writer)
+                                          { ok = writeSync(db, since, writer); });
+
+            sqlite3_exec(db, "COMMIT;", nullptr, 0, nullptr);
+            sqlite3_close(db);
+
+            if (!ok)
+            {
+                res.code = 500;
+                res.write("failed to read changes");
+                return res.end();
+            }
+
+            writeEncoded(res, format, body);
+            return res.end(); }));
+
+    // offline catalog bundle: a gzipped sqlite file of books and rating summaries
+    // supports Range / If-Range for resumed downloads and If-None-Match; continue with /sync?since=<X-Snapshot-Version>
+    CROW_ROUTE(app, "/snapshot").methods(crow::HTTPMethod::GET)([](const crow::request &req, crow::response &res)
+                                                               {
+            auto snapshot = catalogSnapshot.current();
+            if (!snapshot)
+            {
+                res.code = 503;
+                res.set_header("Retry-After", "30");
+                res.write("snapshot not built yet");
+                return res.end();
+            }
+
+            res.set_header("ETag", snapshot->etag);
+            res.set_header("Accept-Ranges", "bytes");
+            res.set_header("X-Snapshot-Version", std::to_string(snapshot->version));
+            if (req.get_header_value("If-None-Match") == snapshot->etag)
+            {
+                res.code = 304;
+                return res.end();
+            }
+
+            const std::string &bytes = snapshot->bytes;
+            std::string if_range = req.get_header_value("If-Range");
+            size_t first = 0, last = 0;
+            RangeResult range = RangeResult::None;
+            if (if_range.empty() || if_range == snapshot->etag)
+            {
+                range = parseByteRange(req.get_header_value("Range"), bytes.size(), first, last);
+            }
+
+            res.set_header("Content-Type", "application/gzip");
+            if (range == RangeResult::Unsatisfiable)
+            {
+                res.code = 416;
+                res.set_header("Content-Range", "bytes */" + std::to_string(bytes.size()));
+                return res.end();
+            }
+            if (range == RangeResult::Partial)
+            {
+                res.code = 206;
+                res.set_header("Content-Range", "bytes " + std::to_string(first) + "-" + std::to_string(last) + "/" + std::to_string(bytes.size()));
+                res.write(bytes.substr(first, last - first + 1));
+                return res.end();
+            }
+
+            res.code = 200;
+            res.write(bytes);
+            return res.end(); });
+
+    // process metrics in the prometheus text format
+    CROW_ROUTE(app, "/metrics").methods(crow::HTTPMethod::GET)([]()
+                                                              {
+        crow::response res(metrics::render());
+        res.set_header("Content-Type", "text/plain; version=0.0.4");
+        return res; });
+
+    // most requested books ( admin only ): /admin/books/hot?book_id=
+    // { "top": [ { "book_id", "requests" } ], "book": { "book_id", "requests" } }, counts are sketch estimates
+    // that only overcount; "book" is there when book_id= asks about one book
+    CROW_ROUTE(app, "/admin/books/hot").methods(crow::HTTPMethod::GET)([](const crow::request &req, crow::response &res)
+                                                                      {
+            int64_t retryAfter = 0;
+            if (!admitClient("/admin/books/hot", "ip", req.remote_ip_address, kAdminLimits.perIp, retryAfter))
+            {
+                res = tooManyRequests(retryAfter);
+                return res.end();
+            }
+
+            respondOnLane(authLane, routeLimiter("/admin/books/hot", kAuthLatencyTarget), req, res, [&req]()
+                          {
+                if (!verifyAdmin(req.get_header_value("X-Username"), req.get_header_value("X-Password")))
+                {
+                    return crow::response(403, "forbidden: admin only");
+                }
+
+                int book_id = intParam(req, "book_id", 0, 0, INT_MAX);
+                auto top = hotBooks.top();
+                ResponseFormat format = negotiateFormat(req.get_header_value("Accept"));
+                std::string body = encodeBody(format, [&](auto &writer)
+                                              {
+                    writer.beginObject(book_id > 0 ? 2 : 1);
+                    writer.key("top");
+                    writer.beginArray();
+                    for (const auto &book : top)
+                    {
+                        writer.beginObject(2);
+                        writer.key("book_id");
+                        writer.integer(book.first);
+                        writer.key("requests");
+                        writer.integer(book.second);
+                        writer.endObject();
+                    }
+                    writer.endArray();
+                    if (book_id > 0)
+                    {
+                        writer.key("book");
+                        writer.beginObject(2);
+                        writer.key("book_id");
+                        writer.integer(book_id);
+                        writer.key("requests");
+                        writer.integer(hotBooks.estimate(book_id));
+                        writer.endObject();
+                    }
+                    writer.endObject(); });
+
+                crow::response out;
+                writeEncoded(out, format, body);
+                return out; }); });
+
+    // bulk catalog import ( admin only, credentials in X-Username / X-Password )
+    CROW_ROUTE(app, "/admin/books/import").methods(crow::HTTPMethod::POST)([](const crow::request &req, crow::response &res)
+                                                                          {
+            int64_t retryAfter = 0;
+            if (!admitClient("/admin/books/import", "ip", req.remote_ip_address, kAdminLimits.perIp, retryAfter) ||
+                !admitClient("/admin/books/import", "user", req.get_header_value("X-Username"), kAdminLimits.perUser, retryAfter))
+            {
+                res = tooManyRequests(retryAfter);
+                return res.end();
+            }
+
+            // credentials are checked on the auth lane, so a stream of bad ones never holds up the writer
+            bool queued = authLane.submit([&req, &res]()
+                                          {
+                if (!verifyAdmin(req.get_header_value("X-Username"), req.get_header_value("X-Password")))
+                {
+                    res.code = 403;
+                    res.write("forbidden: admin only");
+                    return res.end();
+                }
+                onLane<>(writeLane, routeLimiter("/admin/books/import", kWriteLatencyTarget), kNoDeadline, importCatalog)(req, res); });
+            if (!queued)
+            {
+                res = serviceUnavailable();
+                return res.end();
+            } });
+
+    // warming the books that were hot when the server last stopped, before taking requests: their
+    // review lists are read ( bringing the pages into the os cache ) and stored as cached responses
+    app.validate();
+    std::vector<int> hot_ids = hotBooks.loadSaved(kHotBooksPath);
+    for (int book_id : hot_ids)
+    {
+        crow::request req;
+        crow::response res;
+        req.url = bookReviewsPath(book_id);
+        req.raw_url = req.url;
+        app.handle_full(req, res);
+    }
+    if (!hot_ids.empty())
+    {
+        // and their newest reviews, as /reviews serves them
+        std::string ids;
+        for (int book_id : hot_ids)
+        {
+            ids += (ids.empty() ? "" : ",") + std::to_string(book_id);
+        }
+        crow::request req;
+        crow::response res;
+        req.url = "/reviews";
+        req.raw_url = "/reviews?book_ids=" + ids;
+        req.url_params = crow::query_string(req.raw_url);
+        app.handle_full(req, res);
+        std::cout << "prewarmed " << hot_ids.size() << " hot books" << std::endl;
+    }
+
+    // set the port, set the app to run on multiple threads, and run the app
+    app.bindaddr("0.0.0.0").port(18080).multithreaded().run();
+
+    // stopped: keeping the hot list for the next start
+    hotBooks.save(kHotBooksPath);
 }
\ No newline at end of file
@@ -0,0 +1,473 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "catalog_events.h"
+#include "rcu.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MF_HAVE_X86 1
+#endif
+
+// personalized recommendations by matrix factorization
+//
+// rating ~ mean + user bias + book bias + dot(user factors, book factors),
+// trained with parallel SGD: ratings are bucketed into a B x B grid of user
+// and book blocks, and in each sub-epoch every thread owns one bucket of a
+// diagonal, so no two threads touch the same factor rows and each works on a
+// cache-sized slice of both matrices. trained factors are written to a
+// compact binary file which is memory-mapped for serving ( also at startup,
+// so recommendations work before the first retrain finishes ).
+
+constexpr uint32_t kFactorRank = 32; // multiple of 8 for the AVX2 dot product
+constexpr int kFactorEpochs = 20;
+constexpr float kFactorLearningRate = 0.01f;
+constexpr float kFactorRegularization = 0.05f;
+constexpr size_t kRecommendMaxK = 50;
+
+inline float dotScalar(const float *a, const float *b, uint32_t n)
+{
+    float sum = 0;
+    for (uint32_t i = 0; i < n; ++i)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+#ifdef MF_HAVE_X86
+__attribute__((target("avx2,fma"))) inline float dotAvx2(const float *a, const float *b, uint32_t n)
+{
+    __m256 acc = _mm256_setzero_ps();
+    uint32_t i = 0;
+    for (; i + 8 <= n; i += 8)
+        acc = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc);
+    __m128 lo = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    lo = _mm_hadd_ps(lo, lo);
+    lo = _mm_hadd_ps(lo, lo);
+    return _mm_cvtss_f32(lo) + dotScalar(a + i, b + i, n - i);
+}
+#endif
+
+inline float factorDot(const float *a, const float *b, uint32_t n)
+{
+#ifdef MF_HAVE_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+    if (hasAvx2)
+        return dotAvx2(a, b, n);
+#endif
+    return dotScalar(a, b, n);
+}
+
+// on-disk layout, all little endian:
+//   header, int32 userIds[users], int32 bookIds[books], float userBias[users],
+//   float bookBias[books], float userFactors[users * rank], float bookFactors[books * rank]
+//
+struct FactorFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t rank;
+    uint32_t users;
+    uint32_t books;
+    float mean;
+    uint32_t reserved;
+};
+
+static_assert(sizeof(int) == sizeof(int32_t), "factor files store ids as int32");
+
+constexpr char kFactorMagic[8] = {'B', 'R', 'M', 'F', 'A', 'C', 'T', '1'};
+
+// a memory-mapped factor file
+//
+class FactorModel
+{
+public:
+    static std::unique_ptr<FactorModel> open(const std::string &path)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return nullptr;
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(FactorFileHeader))
+        {
+            ::close(fd);
+            return nullptr;
+        }
+
+        size_t size = static_cast<size_t>(st.st_size);
+        void *data = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (data == MAP_FAILED)
+            return nullptr;
+
+        std::unique_ptr<FactorModel> model(new FactorModel(data, size));
+        if (!model->bind())
+            return nullptr;
+        return model;
+    }
+
+    ~FactorModel()
+    {
+        munmap(data_, size_);
+    }
+
+    FactorModel(const FactorModel &) = delete;
+    FactorModel &operator=(const FactorModel &) = delete;
+
+    uint32_t rank() const { return header_->rank; }
+    uint32_t books() const { return header_->books; }
+    int bookId(uint32_t row) const { return bookIds_[row]; }
+
+    // -1 when the user has no factors ( no reviews at training time )
+    int userRow(int userId) const
+    {
+        auto it = userRows_.find(userId);
+        return it == userRows_.end() ? -1 : static_cast<int>(it->second);
+    }
+
+    // score used for ranking one user's books ( the user's own bias and the
+    // global mean are the same for every book, so they are left out )
+    float score(int userRow, uint32_t bookRow) const
+    {
+        float s = bookBias_[bookRow];
+        if (userRow >= 0)
+            s += factorDot(userFactors_ + static_cast<size_t>(userRow) * rank(), bookFactors_ + static_cast<size_t>(bookRow) * rank(), rank());
+        return s;
+    }
+
+private:
+    FactorModel(void *data, size_t size) : data_(data), size_(size) {}
+
+    bool bind()
+    {
+        header_ = static_cast<const FactorFileHeader *>(data_);
+        if (std::memcmp(header_->magic, kFactorMagic, sizeof(kFactorMagic)) != 0 || header_->version != 1 || header_->rank == 0)
+            return false;
+
+        size_t users = header_->users, books = header_->books, rank = header_->rank;
+        size_t expected = sizeof(FactorFileHeader) + 4 * (users + books) * 2 + 4 * rank * (users + books);
+        if (size_ != expected)
+            return false;
+
+        const char *p = static_cast<const char *>(data_) + sizeof(FactorFileHeader);
+        const int32_t *userIds = reinterpret_cast<const int32_t *>(p);
+        bookIds_ = userIds + users;
+        bookBias_ = reinterpret_cast<const float *>(bookIds_ + books) + users; // skip user biases
+        userFactors_ = bookBias_ + books;
+        bookFactors_ = userFactors_ + users * rank;
+
+        userRows_.reserve(users);
+        for (uint32_t i = 0; i < users; ++i)
+            userRows_.emplace(userIds[i], i);
+        return true;
+    }
+
+    void *data_;
+    size_t size_;
+    const FactorFileHeader *header_ = nullptr;
+    const int32_t *bookIds_ = nullptr;
+    const float *bookBias_ = nullptr;
+    const float *userFactors_ = nullptr;
+    const float *bookFactors_ = nullptr;
+    std::unordered_map<int, uint32_t> userRows_;
+};
+
+struct Recommendation
+{
+    int bookId;
+    float score;
+};
+
+class MatrixFactorization
+{
+public:
+    explicit MatrixFactorization(std::string path) : path_(std::move(path)) {}
+    MatrixFactorization(const MatrixFactorization &) = delete;
+    MatrixFactorization &operator=(const MatrixFactorization &) = delete;
+
+    ~MatrixFactorization()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (trainer_.joinable())
+            trainer_.join();
+    }
+
+    // mapping the last trained model and starting the background trainer
+    //
+    void start(const char *dbName, std::chrono::milliseconds minInterval)
+    {
+        if (auto model = FactorModel::open(path_))
+        {
+            std::lock_guard<std::mutex> lock(model_.writerMutex());
+            model_.publish(std::move(model));
+        }
+        else
+        {
+            dirty_ = true; // nothing usable on disk, train right away
+        }
+
+        dbName_ = dbName;
+        trainer_ = std::thread([this, minInterval]()
+                               { run(minInterval); });
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        dirty_ = true;
+        wake_.notify_one();
+    }
+
+    // best k books for a user, skipping the ones they already reviewed
+    //
+    std::vector<Recommendation> recommend(int userId, const std::unordered_set<int> &exclude, size_t k) const
+    {
+        std::vector<Recommendation> heap;
+        k = std::min(k, kRecommendMaxK);
+        auto model = model_.read();
+        if (!model || k == 0)
+            return heap;
+
+        auto worse = [](const Recommendation &a, const Recommendation &b)
+        { return a.score > b.score; };
+        int userRow = model->userRow(userId);
+        for (uint32_t row = 0; row < model->books(); ++row)
+        {
+            int bookId = model->bookId(row);
+            if (exclude.count(bookId))
+                continue;
+            float s = model->score(userRow, row);
+            if (heap.size() < k)
+            {
+                heap.push_back({bookId, s});
+                std::push_heap(heap.begin(), heap.end(), worse);
+            }
+            else if (s > heap.front().score)
+            {
+                std::pop_heap(heap.begin(), heap.end(), worse);
+                heap.back() = {bookId, s};
+                std::push_heap(heap.begin(), heap.end(), worse);
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), worse);
+        return heap;
+    }
+
+private:
+    struct Sample
+    {
+        uint32_t user;
+        uint32_t book;
+        float rating;
+    };
+
+    void run(std::chrono::milliseconds minInterval)
+    {
+        for (;;)
+        {
+            {
+                std::unique_lock<std::mutex> lock(mutex_);
+                wake_.wait(lock, [this]
+                           { return stopping_ || dirty_; });
+                if (stopping_)
+                    return;
+                dirty_ = false;
+            }
+
+            train();
+
+            // retrain at most once per interval, however many reviews arrive
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (wake_.wait_for(lock, minInterval, [this]
+                               { return stopping_; }))
+                return;
+        }
+    }
+
+    void train()
+    {
+        auto started = std::chrono::steady_clock::now();
+
+        std::vector<int> userIds, bookIds;
+        std::vector<Sample> samples;
+        if (!loadSamples(userIds, bookIds, samples) || samples.empty())
+            return;
+
+        size_t users = userIds.size(), books = bookIds.size();
+        double total = 0;
+        for (const auto &s : samples)
+            total += s.rating;
+        float mean = static_cast<float>(total / samples.size());
+
+        std::mt19937 rng(42);
+        std::normal_distribution<float> init(0.0f, 0.1f);
+        std::vector<float> userBias(users, 0.0f), bookBias(books, 0.0f);
+        std::vector<float> P(users * kFactorRank), Q(books * kFactorRank);
+        for (auto &v : P)
+            v = init(rng);
+        for (auto &v : Q)
+            v = init(rng);
+
+        // B x B buckets of samples, by user block and book block
+        size_t blocks = std::max<size_t>(1, std::min<size_t>(std::thread::hardware_concurrency(), std::min(users, books)));
+        std::vector<std::vector<Sample>> buckets(blocks * blocks);
+        std::shuffle(samples.begin(), samples.end(), rng);
+        for (const auto &s : samples)
+            buckets[(s.user % blocks) * blocks + (s.book % blocks)].push_back(s);
+        std::vector<Sample>().swap(samples);
+
+        for (int epoch = 0; epoch < kFactorEpochs; ++epoch)
+        {
+            for (size_t shift = 0; shift < blocks; ++shift)
+            {
+                std::vector<std::thread> threads;
+                for (size_t b = 0; b < blocks; ++b)
+                {
+                    const std::vector<Sample> &bucket = buckets[b * blocks + (b + shift) % blocks];
+                    threads.emplace_back([&, mean]()
+                                         { sgd(bucket, mean, userBias, bookBias, P, Q); });
+                }
+                for (auto &t : threads)
+                    t.join();
+            }
+        }
+
+        if (!save(userIds, bookIds, mean, userBias, bookBias, P, Q))
+            return;
+
+        auto model = FactorModel::open(path_);
+        if (!model)
+        {
+            std::cerr << "recommendations: cannot map " << path_ << std::endl;
+            return;
+        }
+        {
+            std::lock_guard<std::mutex> lock(model_.writerMutex());
+            model_.publish(std::move(model));
+        }
+
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+        std::cout << "recommendations: trained on " << users << " users x " << books << " books in " << seconds << "s" << std::endl;
+    }
+
+    static void sgd(const std::vector<Sample> &bucket, float mean, std::vector<float> &userBias, std::vector<float> &bookBias,
+                    std::vector<float> &P, std::vector<float> &Q)
+    {
+        for (const auto &s : bucket)
+        {
+            float *p = P.data() + static_cast<size_t>(s.user) * kFactorRank;
+            float *q = Q.data() + static_cast<size_t>(s.book) * kFactorRank;
+            float error = s.rating - (mean + userBias[s.user] + bookBias[s.book] + factorDot(p, q, kFactorRank));
+
+            userBias[s.user] += kFactorLearningRate * (error - kFactorRegularization * userBias[s.user]);
+            bookBias[s.book] += kFactorLearningRate * (error - kFactorRegularization * bookBias[s.book]);
+            for (uint32_t f = 0; f < kFactorRank; ++f)
+            {
+                float pf = p[f], qf = q[f];
+                p[f] += kFactorLearningRate * (error * qf - kFactorRegularization * pf);
+                q[f] += kFactorLearningRate * (error * pf - kFactorRegularization * qf);
+            }
+        }
+    }
+
+    bool loadSamples(std::vector<int> &userIds, std::vector<int> &bookIds, std::vector<Sample> &samples) const
+    {
+        sqlite3 *db;
+        if (sqlite3_open_v2(dbName_.c_str(), &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        std::unordered_map<int, uint32_t> userRows, bookRows;
+        sqlite3_stmt *stmt = nullptr;
+        int rc = SQLITE_ERROR;
+        if (sqlite3_prepare_v2(db, "SELECT user_id, book_id, rating FROM reviews;", -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                int user = sqlite3_column_int(stmt, 0), book = sqlite3_column_int(stmt, 1);
+                auto u = userRows.emplace(user, static_cast<uint32_t>(userIds.size()));
+                if (u.second)
+                    userIds.push_back(user);
+                auto b = bookRows.emplace(book, static_cast<uint32_t>(bookIds.size()));
+                if (b.second)
+                    bookIds.push_back(book);
+                samples.push_back({u.first->second, b.first->second, static_cast<float>(sqlite3_column_int(stmt, 2))});
+            }
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return rc == SQLITE_DONE;
+    }
+
+    bool save(const std::vector<int> &userIds, const std::vector<int> &bookIds, float mean, const std::vector<float> &userBias,
+              const std::vector<float> &bookBias, const std::vector<float> &P, const std::vector<float> &Q) const
+    {
+        std::string tmp = path_ + ".tmp";
+        FILE *f = std::fopen(tmp.c_str(), "wb");
+        if (!f)
+            return false;
+
+        FactorFileHeader header{};
+        std::memcpy(header.magic, kFactorMagic, sizeof(kFactorMagic));
+        header.version = 1;
+        header.rank = kFactorRank;
+        header.users = static_cast<uint32_t>(userIds.size());
+        header.books = static_cast<uint32_t>(bookIds.size());
+        header.mean = mean;
+
+        bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1;
+        auto write = [&](const void *data, size_t bytes)
+        { ok = ok && (bytes == 0 || std::fwrite(data, bytes, 1, f) == 1); };
+        write(userIds.data(), userIds.size() * sizeof(int32_t));
+        write(bookIds.data(), bookIds.size() * sizeof(int32_t));
+        write(userBias.data(), userBias.size() * sizeof(float));
+        write(bookBias.data(), bookBias.size() * sizeof(float));
+        write(P.data(), P.size() * sizeof(float));
+        write(Q.data(), Q.size() * sizeof(float));
+        ok = std::fclose(f) == 0 && ok;
+
+        // readers keep their old mapping; rename only swaps the directory entry
+        if (!ok || std::rename(tmp.c_str(), path_.c_str()) != 0)
+        {
+            std::remove(tmp.c_str());
+            std::cerr << "recommendations: cannot write " << path_ << std::endl;
+            return false;
+        }
+        return true;
+    }
+
+    std::string path_;
+    std::string dbName_;
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool dirty_ = false;
+    bool stopping_ = false;
+    std::thread trainer_;
+    RcuCell<FactorModel> model_;
+};
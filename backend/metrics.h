@@ -0,0 +1,145 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+
+// process metrics, exposed at GET /metrics in the prometheus text format
+//
+// a metric is registered once by name ( labels included, e.g.
+// lane_queue_seconds{lane="read"} ) and the returned reference stays valid
+// for the life of the process, so hot paths keep it in a static and only
+// touch atomics.
+namespace metrics
+{
+    class Counter
+    {
+    public:
+        void inc(uint64_t n = 1) { value_.fetch_add(n, std::memory_order_relaxed); }
+        uint64_t value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> value_{0};
+    };
+
+    class Gauge
+    {
+    public:
+        void set(double value) { value_.store(value, std::memory_order_relaxed); }
+        void add(double delta)
+        {
+            double current = value_.load(std::memory_order_relaxed);
+            while (!value_.compare_exchange_weak(current, current + delta, std::memory_order_relaxed))
+            {
+            }
+        }
+        double value() const { return value_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> value_{0};
+    };
+
+    // count and sum of observations ( durations in seconds, sizes, ... )
+    class Summary
+    {
+    public:
+        void observe(double value)
+        {
+            count_.fetch_add(1, std::memory_order_relaxed);
+            double current = sum_.load(std::memory_order_relaxed);
+            while (!sum_.compare_exchange_weak(current, current + value, std::memory_order_relaxed))
+            {
+            }
+        }
+        uint64_t count() const { return count_.load(std::memory_order_relaxed); }
+        double sum() const { return sum_.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> count_{0};
+        std::atomic<double> sum_{0};
+    };
+
+    struct Entry
+    {
+        std::string help;
+        std::unique_ptr<Counter> counter;
+        std::unique_ptr<Gauge> gauge;
+        std::unique_ptr<Summary> summary;
+    };
+
+    // "name{labels}" -> "name" and "{labels}"
+    inline std::pair<std::string, std::string> splitName(const std::string &full)
+    {
+        size_t brace = full.find('{');
+        return {full.substr(0, brace), brace == std::string::npos ? "" : full.substr(brace)};
+    }
+
+    inline std::mutex registryMutex;
+    inline std::map<std::pair<std::string, std::string>, Entry> registry; // ( name, labels ), so a name's series stay together
+
+    template <class Metric>
+    Metric &find(std::unique_ptr<Metric> Entry::*slot, const std::string &name, const std::string &help)
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        Entry &entry = registry[splitName(name)];
+        if (!(entry.*slot))
+        {
+            entry.help = help;
+            entry.*slot = std::make_unique<Metric>();
+        }
+        return *(entry.*slot);
+    }
+
+    inline Counter &counter(const std::string &name, const std::string &help)
+    {
+        return find(&Entry::counter, name, help);
+    }
+
+    inline Gauge &gauge(const std::string &name, const std::string &help)
+    {
+        return find(&Entry::gauge, name, help);
+    }
+
+    inline Summary &summary(const std::string &name, const std::string &help)
+    {
+        return find(&Entry::summary, name, help);
+    }
+
+    // every metric in the text exposition format
+    //
+    inline std::string render()
+    {
+        std::ostringstream out;
+        std::string lastBase;
+        std::lock_guard<std::mutex> lock(registryMutex);
+        for (const auto &item : registry)
+        {
+            const std::string &base = item.first.first;
+            const std::string &labels = item.first.second;
+            const Entry &entry = item.second;
+            if (base != lastBase)
+            {
+                const char *type = entry.counter ? "counter" : entry.gauge ? "gauge"
+                                                                           : "summary";
+                out << "# HELP " << base << " " << entry.help << "\n";
+                out << "# TYPE " << base << " " << type << "\n";
+                lastBase = base;
+            }
+            if (entry.counter)
+                out << base << labels << " " << entry.counter->value() << "\n";
+            if (entry.gauge)
+                out << base << labels << " " << entry.gauge->value() << "\n";
+            if (entry.summary)
+            {
+                out << base << "_count" << labels << " " << entry.summary->count() << "\n";
+                out << base << "_sum" << labels << " " << entry.summary->sum() << "\n";
+            }
+        }
+        return out.str();
+    }
+}
@@ -0,0 +1,84 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <thread>
+#include "bcrypt/BCrypt.hpp"
+
+// bcrypt work factor, calibrated to this machine at startup
+//
+// every cost step doubles the hash time. the chosen cost is the highest one
+// whose hash, multiplied by how many logins queue for each core at the
+// expected concurrency, still fits the latency budget. the cost is part of
+// every hash ( "$2b$12$..." ), so hashes made under an older, lower cost are
+// recognised and upgraded on the next successful login. calibration only
+// ever raises the cost: 12, the fixed cost used before it, is the floor even
+// on a machine too slow for the budget.
+
+constexpr int kBcryptMinCost = 12; // the former fixed cost; never weaker, whatever the budget says
+constexpr int kBcryptMaxCost = 16;
+constexpr int kBcryptDefaultBudgetMs = 250;
+
+inline std::atomic<int> passwordCost{kBcryptMinCost};
+
+// the cost field of a bcrypt hash, 0 when it is not one
+//
+inline int bcryptCost(const std::string &hash)
+{
+    // $2a$, $2b$, $2y$ ... then two digits and a '$'
+    if (hash.size() < 7 || hash[0] != '$' || hash[1] != '2' || hash[3] != '$' || hash[6] != '$' ||
+        hash[4] < '0' || hash[4] > '9' || hash[5] < '0' || hash[5] > '9')
+        return 0;
+    return (hash[4] - '0') * 10 + (hash[5] - '0');
+}
+
+// an integer from the environment, or the fallback when unset or not positive
+inline int envInt(const char *name, int fallback)
+{
+    const char *value = std::getenv(name);
+    int parsed = value ? std::atoi(value) : 0;
+    return parsed > 0 ? parsed : fallback;
+}
+
+// timing one hash at each cost, upwards until the budget is exceeded
+//
+// budgetMs is the acceptable login latency, concurrency the number of logins
+// expected at the same moment; beyond one per core they wait for each other.
+inline int calibratePasswordCost(int budgetMs, int concurrency)
+{
+    int cores = std::max(1u, std::thread::hardware_concurrency());
+    double queued = std::max(1.0, static_cast<double>(concurrency) / cores);
+    double budget = budgetMs / 1000.0;
+
+    int chosen = kBcryptMinCost;
+    for (int cost = kBcryptMinCost; cost <= kBcryptMaxCost; ++cost)
+    {
+        auto start = std::chrono::steady_clock::now();
+        BCrypt::generateHash("calibration", cost);
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+        if (seconds * queued > budget)
+        {
+            if (cost == kBcryptMinCost)
+                std::cerr << "bcrypt: cost " << cost << " takes " << seconds * 1000 << "ms, over the "
+                          << budgetMs << "ms budget; keeping it as the floor" << std::endl;
+            break;
+        }
+        chosen = cost;
+        // the next step takes twice as long, no need to measure it when that is already over
+        if (seconds * 2 * queued > budget)
+            break;
+    }
+    return chosen;
+}
+
+// whether a stored hash should be replaced by one at the current cost
+//
+inline bool needsRehash(const std::string &hash)
+{
+    return bcryptCost(hash) < passwordCost.load(std::memory_order_relaxed);
+}
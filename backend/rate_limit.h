@@ -0,0 +1,141 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+
+// per client token buckets for expensive routes
+//
+// each bucket is one 64 bit word: a 24 bit key tag and the bucket's
+// "theoretical arrival time" in milliseconds ( GCRA ). that time moves
+// forward by one emission interval per admitted request and a request is
+// refused when it would run more than `burst` intervals ahead of now, which is
+// a token bucket of size burst refilled at `rate`, refilled lazily by the
+// clock. a bucket whose time is in the past is full, and so equivalent to no
+// bucket: its slot can be taken by another key, which is all idle eviction
+// needs. one compare-and-swap per request, no locks.
+//
+// the table is split into shards of 8 slots, one cache line each; a key
+// probes only its own shard. when every slot of a shard is busy with an active
+// bucket the request is let through and counted, limiting is best effort there.
+
+struct RateRule
+{
+    double perSecond; // refill rate, 0 disables the rule
+    int burst;        // bucket size
+};
+
+enum class RateDecision
+{
+    Allowed,
+    Limited,
+    Untracked // the shard was full of active buckets
+};
+
+class RateLimiter
+{
+public:
+    explicit RateLimiter(size_t shards = 8192)
+        : shards_(new Shard[shards]), shardCount_(shards), epoch_(std::chrono::steady_clock::now())
+    {
+    }
+
+    // taking one token from the bucket for `key` under `rule`
+    //
+    // retryAfterMs is set when the request is refused: how long until a token is back
+    RateDecision acquire(const std::string &key, const RateRule &rule, int64_t &retryAfterMs)
+    {
+        if (rule.perSecond <= 0 || rule.burst <= 0)
+            return RateDecision::Allowed;
+
+        uint64_t hash = std::hash<std::string>()(key) * 0x9e3779b97f4a7c15ULL;
+        uint64_t tag = hash >> 40;
+        if (tag == 0)
+            tag = 1; // 0 marks an empty slot
+        Shard &shard = shards_[(hash ^ (hash >> 29)) % shardCount_];
+
+        int64_t interval = std::max<int64_t>(1, static_cast<int64_t>(1000.0 / rule.perSecond));
+        int64_t window = interval * rule.burst;
+        int64_t now = nowMs();
+
+        for (int attempt = 0; attempt < 4; ++attempt)
+        {
+            std::atomic<uint64_t> *mine = nullptr, *reusable = nullptr;
+            uint64_t seen = 0, reusableSeen = 0;
+            for (auto &slot : shard.slots)
+            {
+                uint64_t value = slot.load(std::memory_order_acquire);
+                if (value >> kTimeBits == tag)
+                {
+                    mine = &slot;
+                    seen = value;
+                    break;
+                }
+                if (!reusable && static_cast<int64_t>(value & kTimeMask) <= now)
+                {
+                    reusable = &slot;
+                    reusableSeen = value;
+                }
+            }
+
+            if (!mine)
+            {
+                if (!reusable)
+                    return RateDecision::Untracked;
+                // a new or refilled bucket always has room for the first request
+                if (reusable->compare_exchange_strong(reusableSeen, pack(tag, now + interval), std::memory_order_acq_rel))
+                    return RateDecision::Allowed;
+                continue;
+            }
+
+            while (seen >> kTimeBits == tag)
+            {
+                int64_t next = std::max(static_cast<int64_t>(seen & kTimeMask), now) + interval;
+                if (next - now > window)
+                {
+                    retryAfterMs = next - now - window;
+                    return RateDecision::Limited;
+                }
+                if (mine->compare_exchange_weak(seen, pack(tag, next), std::memory_order_acq_rel))
+                    return RateDecision::Allowed;
+            }
+            // the slot was taken over by another key, look again
+        }
+        return RateDecision::Untracked;
+    }
+
+private:
+    static constexpr int kTimeBits = 40; // milliseconds, about 34 years
+    static constexpr uint64_t kTimeMask = (uint64_t(1) << kTimeBits) - 1;
+
+    struct alignas(64) Shard
+    {
+        std::atomic<uint64_t> slots[8] = {};
+    };
+
+    static uint64_t pack(uint64_t tag, int64_t time)
+    {
+        return tag << kTimeBits | (static_cast<uint64_t>(time) & kTimeMask);
+    }
+
+    // starting at 1, so an empty slot ( time 0 ) always reads as idle
+    int64_t nowMs() const
+    {
+        return 1 + std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - epoch_).count();
+    }
+
+    std::unique_ptr<Shard[]> shards_;
+    size_t shardCount_;
+    std::chrono::steady_clock::time_point epoch_;
+};
+
+// limits for one route: a bucket per client address and one per username
+struct RouteLimits
+{
+    RateRule perIp;
+    RateRule perUser;
+};
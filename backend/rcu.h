@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// read-copy-update cell
+//
+// holds an immutable T that readers use without taking any lock: a reader
+// bumps the counter of the current epoch, loads the pointer and drops the
+// counter when done. a writer swaps in a new T, flips the epoch twice ( once
+// per counter ) waiting for each counter to drain, and only then frees the old
+// value, so no reader can still be looking at it.
+//
+template <typename T>
+class RcuCell
+{
+public:
+    RcuCell() = default;
+    explicit RcuCell(std::unique_ptr<const T> initial) : current_(initial.release()) {}
+    RcuCell(const RcuCell &) = delete;
+    RcuCell &operator=(const RcuCell &) = delete;
+
+    ~RcuCell()
+    {
+        delete current_.load();
+    }
+
+    // pins the current value for as long as the guard lives
+    //
+    class ReadGuard
+    {
+    public:
+        explicit ReadGuard(const RcuCell &cell) : cell_(cell)
+        {
+            slot_ = cell_.epoch_.load(std::memory_order_acquire) & 1;
+            cell_.readers_[slot_].fetch_add(1, std::memory_order_seq_cst);
+            value_ = cell_.current_.load(std::memory_order_seq_cst);
+        }
+
+        ~ReadGuard()
+        {
+            cell_.readers_[slot_].fetch_sub(1, std::memory_order_release);
+        }
+
+        ReadGuard(const ReadGuard &) = delete;
+        ReadGuard &operator=(const ReadGuard &) = delete;
+
+        const T *get() const { return value_; }
+        const T *operator->() const { return value_; }
+        const T &operator*() const { return *value_; }
+        explicit operator bool() const { return value_ != nullptr; }
+
+    private:
+        const RcuCell &cell_;
+        uint64_t slot_;
+        const T *value_;
+    };
+
+    ReadGuard read() const
+    {
+        return ReadGuard(*this);
+    }
+
+    // publishing a new value; blocks until no reader can see the old one
+    //
+    void publish(std::unique_ptr<const T> next)
+    {
+        std::lock_guard<std::mutex> lock(writer_);
+        const T *old = current_.exchange(next.release(), std::memory_order_seq_cst);
+        for (int pass = 0; pass < 2; ++pass)
+        {
+            uint64_t slot = epoch_.fetch_add(1, std::memory_order_seq_cst) & 1;
+            while (readers_[slot].load(std::memory_order_acquire) != 0)
+            {
+                std::this_thread::yield();
+            }
+        }
+        delete old;
+    }
+
+    // serializes read-modify-publish sequences between writers
+    //
+    std::mutex &writerMutex() { return updater_; }
+
+private:
+    std::atomic<const T *> current_{nullptr};
+    mutable std::atomic<uint64_t> epoch_{0};
+    mutable std::atomic<int64_t> readers_[2] = {{0}, {0}};
+    std::mutex writer_;
+    std::mutex updater_;
+};
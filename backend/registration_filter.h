@@ -0,0 +1,247 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// taken usernames and emails, so /register can refuse duplicates before bcrypt
+//
+// a bloom filter per column: "no" is certain and skips the database, "maybe"
+// is confirmed with an indexed query. bits are set with atomic or, so lookups
+// and inserts need no lock. when the user count outgrows the filters a
+// background thread rebuilds them twice as large from the users table and
+// swaps them in; /register never waits for that scan. a failed rebuild is
+// retried with a growing pause, and until one succeeds the full filters just
+// answer "maybe" more often.
+
+constexpr std::chrono::seconds kFilterRebuildRetry{1};     // first retry after a failed rebuild, doubling
+constexpr std::chrono::seconds kFilterRebuildRetryMax{60};
+
+class BloomFilter
+{
+public:
+    // sized for `capacity` keys at about a 1% false positive rate
+    explicit BloomFilter(size_t capacity)
+    {
+        size_t bits = static_cast<size_t>(std::ceil(capacity * 9.6)); // -ln(0.01) / ln(2)^2
+        words_ = std::vector<std::atomic<uint64_t>>(std::max<size_t>(1, (bits + 63) / 64));
+        bits_ = words_.size() * 64;
+    }
+
+    void add(const std::string &key)
+    {
+        uint64_t h1, h2;
+        hash(key, h1, h2);
+        for (int i = 0; i < kHashes; ++i)
+        {
+            uint64_t bit = (h1 + i * h2) % bits_;
+            words_[bit / 64].fetch_or(uint64_t(1) << (bit % 64), std::memory_order_relaxed);
+        }
+    }
+
+    bool mightContain(const std::string &key) const
+    {
+        uint64_t h1, h2;
+        hash(key, h1, h2);
+        for (int i = 0; i < kHashes; ++i)
+        {
+            uint64_t bit = (h1 + i * h2) % bits_;
+            if (!(words_[bit / 64].load(std::memory_order_relaxed) & (uint64_t(1) << (bit % 64))))
+                return false;
+        }
+        return true;
+    }
+
+private:
+    static constexpr int kHashes = 7; // optimal for 1%
+
+    // two independent 64 bit hashes ( fnv-1a, then two splitmix finalizers ), combined by double hashing
+    static void hash(const std::string &key, uint64_t &h1, uint64_t &h2)
+    {
+        uint64_t h = 14695981039346656037ULL;
+        for (unsigned char c : key)
+        {
+            h ^= c;
+            h *= 1099511628211ULL;
+        }
+        h1 = mix(h);
+        h2 = mix(h ^ 0x9e3779b97f4a7c15ULL) | 1;
+    }
+
+    static uint64_t mix(uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+
+    std::vector<std::atomic<uint64_t>> words_;
+    uint64_t bits_;
+};
+
+class RegistrationFilter
+{
+public:
+    ~RegistrationFilter()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+    // building both filters from the users table
+    //
+    bool load(const char *dbName)
+    {
+        dbName_ = dbName;
+        sqlite3 *db;
+        if (sqlite3_open_v2(dbName, &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        int64_t users = 0;
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(db, "SELECT COUNT(*) FROM users;", -1, &stmt, nullptr) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW)
+            users = sqlite3_column_int64(stmt, 0);
+        sqlite3_finalize(stmt);
+
+        auto filters = std::make_shared<Filters>(std::max<size_t>(kMinCapacity, static_cast<size_t>(users) * 2));
+        int rc = SQLITE_ERROR;
+        if (sqlite3_prepare_v2(db, "SELECT username, email FROM users;", -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                filters->usernames.add(text(stmt, 0));
+                filters->emails.add(text(stmt, 1));
+                ++filters->count;
+            }
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        if (rc != SQLITE_DONE)
+            return false;
+
+        std::atomic_store(&filters_, filters);
+        return true;
+    }
+
+    // false when neither the username nor the email can be taken
+    //
+    bool mightBeTaken(const std::string &username, const std::string &email) const
+    {
+        auto filters = std::atomic_load(&filters_);
+        return !filters || filters->usernames.mightContain(username) || filters->emails.mightContain(email);
+    }
+
+    // starting the thread that rebuilds the filters once add() finds them full
+    //
+    void start()
+    {
+        worker_ = std::thread([this]()
+                              {
+            std::chrono::seconds retry = kFilterRebuildRetry;
+            std::unique_lock<std::mutex> lock(mutex_);
+            for (;;)
+            {
+                wake_.wait(lock, [this]()
+                           { return stopping_ || rebuildWanted_; });
+                if (stopping_)
+                    return;
+                lock.unlock();
+                bool ok = load(dbName_.c_str()); // a user stored while this scans is a false "no",
+                                                 // still caught by the UNIQUE columns
+                lock.lock();
+                rebuildWanted_ = !ok;
+                if (ok)
+                {
+                    retry = kFilterRebuildRetry;
+                    continue;
+                }
+                std::cerr << "registration filter: rebuild failed, retrying in " << retry.count() << "s" << std::endl;
+                wake_.wait_for(lock, retry, [this]()
+                               { return stopping_; });
+                retry = std::min(retry * 2, kFilterRebuildRetryMax);
+            } });
+    }
+
+    // recording a stored user, asking for a larger rebuild once the filters are full
+    //
+    void add(const std::string &username, const std::string &email)
+    {
+        auto filters = std::atomic_load(&filters_);
+        if (!filters)
+            return;
+        filters->usernames.add(username);
+        filters->emails.add(email);
+        if (++filters->count > filters->capacity)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex_);
+                rebuildWanted_ = true;
+            }
+            wake_.notify_one();
+        }
+    }
+
+private:
+    static constexpr size_t kMinCapacity = 100000;
+
+    struct Filters
+    {
+        explicit Filters(size_t cap) : usernames(cap), emails(cap), capacity(cap) {}
+
+        BloomFilter usernames;
+        BloomFilter emails;
+        size_t capacity;
+        std::atomic<size_t> count{0};
+    };
+
+    static std::string text(sqlite3_stmt *stmt, int column)
+    {
+        const char *value = reinterpret_cast<const char *>(sqlite3_column_text(stmt, column));
+        return value ? value : "";
+    }
+
+    std::string dbName_;
+    std::shared_ptr<Filters> filters_;
+    std::mutex mutex_; // guards rebuildWanted_ and stopping_
+    std::condition_variable wake_;
+    bool rebuildWanted_ = false;
+    bool stopping_ = false;
+    std::thread worker_;
+};
+
+// exact check behind a filter hit: does a user with this username or email exist
+//
+inline bool userExists(sqlite3 *db, const std::string &username, const std::string &email)
+{
+    // both columns are UNIQUE, so each side of the OR is an index lookup
+    const char *sql = "SELECT 1 FROM users WHERE username = ? OR email = ? LIMIT 1;";
+    sqlite3_stmt *stmt = nullptr;
+    bool exists = false;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        sqlite3_bind_text(stmt, 1, username.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_text(stmt, 2, email.c_str(), -1, SQLITE_TRANSIENT);
+        exists = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+    return exists;
+}
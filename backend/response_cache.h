@@ -0,0 +1,146 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// stale-while-revalidate response cache
+//
+// an entry is fresh until its soft ttl, then stale until its hard ttl, then
+// gone. a stale entry is still served at once, and the first reader to see it
+// stale is told to refresh it in the background; the others keep getting the
+// stale copy meanwhile. every entry carries a tag ( the request path ) that
+// writes use to mark its entries stale, or to drop them outright for clients
+// that must read their own write. a refresh that started before such a write
+// is not stored. when full, the least recently used entry makes room.
+
+template <class Value>
+class StaleWhileRevalidateCache
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    explicit StaleWhileRevalidateCache(size_t maxEntries = 1024) : maxEntries_(maxEntries) {}
+
+    struct Lookup
+    {
+        std::shared_ptr<const Value> value; // null on a miss
+        bool stale = false;
+        bool refresh = false;    // this reader should start the refresh
+        uint64_t generation = 0; // pass to put
+    };
+
+    Lookup get(const std::string &key, const std::string &tag)
+    {
+        Lookup lookup;
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        lookup.generation = generationOf(tag);
+        auto entry = entries_.find(key);
+        if (entry == entries_.end() || now >= entry->second.expiresAt)
+            return lookup;
+
+        recency_.splice(recency_.begin(), recency_, entry->second.used);
+        lookup.value = entry->second.value;
+        lookup.stale = now >= entry->second.freshUntil;
+        if (lookup.stale && !entry->second.refreshing)
+        {
+            entry->second.refreshing = true;
+            lookup.refresh = true;
+        }
+        return lookup;
+    }
+
+    // storing a value computed since get returned `generation`
+    //
+    void put(const std::string &key, const std::string &tag, std::shared_ptr<const Value> value, uint64_t generation,
+             std::chrono::seconds softTtl, std::chrono::seconds hardTtl)
+    {
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation != generationOf(tag))
+        {
+            // written to meanwhile; let the next reader try again
+            auto entry = entries_.find(key);
+            if (entry != entries_.end())
+                entry->second.refreshing = false;
+            return;
+        }
+        auto entry = entries_.find(key);
+        if (entry == entries_.end())
+        {
+            if (entries_.size() >= maxEntries_ && !recency_.empty())
+            {
+                entries_.erase(recency_.back());
+                recency_.pop_back();
+            }
+            recency_.push_front(key);
+            entries_.emplace(key, Entry{tag, std::move(value), now + softTtl, now + hardTtl, false, recency_.begin()});
+            return;
+        }
+        recency_.splice(recency_.begin(), recency_, entry->second.used);
+        entry->second = {tag, std::move(value), now + softTtl, now + hardTtl, false, recency_.begin()};
+    }
+
+    // a refresh that produced nothing to store
+    //
+    void refreshFailed(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto entry = entries_.find(key);
+        if (entry != entries_.end())
+            entry->second.refreshing = false;
+    }
+
+    // a write: entries under `tag` become stale now ( or are dropped ) and refreshes in flight are discarded
+    //
+    void invalidate(const std::string &tag, bool drop)
+    {
+        auto now = Clock::now();
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generations_[tag];
+        for (auto entry = entries_.begin(); entry != entries_.end();)
+        {
+            if (entry->second.tag != tag)
+                ++entry;
+            else if (drop)
+            {
+                recency_.erase(entry->second.used);
+                entry = entries_.erase(entry);
+            }
+            else
+            {
+                entry->second.freshUntil = now;
+                entry->second.refreshing = false;
+                ++entry;
+            }
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::string tag;
+        std::shared_ptr<const Value> value;
+        Clock::time_point freshUntil;
+        Clock::time_point expiresAt;
+        bool refreshing;
+        std::list<std::string>::iterator used; // place in recency_
+    };
+
+    uint64_t generationOf(const std::string &tag) const
+    {
+        auto generation = generations_.find(tag);
+        return generation == generations_.end() ? 0 : generation->second;
+    }
+
+    size_t maxEntries_;
+    std::mutex mutex_;
+    std::unordered_map<std::string, Entry> entries_;
+    std::list<std::string> recency_; // keys, most recently used first
+    std::unordered_map<std::string, uint64_t> generations_;
+};
@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "json_writer.h"
+
+// binary response encodings
+//
+// MsgPackWriter and CborWriter share JsonWriter's interface, so a document
+// written against a template Writer comes out in any of the three. all of
+// them append into one caller-owned string; nothing is allocated per value.
+// the format is picked from the request's Accept header.
+
+enum class ResponseFormat
+{
+    Json,
+    MsgPack,
+    Cbor
+};
+
+// appending the low `bytes` bytes of value, big endian
+inline void appendBigEndian(std::string &out, uint64_t value, int bytes)
+{
+    for (int shift = (bytes - 1) * 8; shift >= 0; shift -= 8)
+        out += static_cast<char>((value >> shift) & 0xFF);
+}
+
+class MsgPackWriter
+{
+public:
+    explicit MsgPackWriter(std::string &out) : out_(out)
+    {
+        stack_.reserve(8); // the documents nest two or three levels
+    }
+
+    static constexpr const char *contentType = "application/msgpack";
+
+    // arrays are streamed, so the length is a 32 bit slot patched by endArray
+    void beginArray()
+    {
+        countValue();
+        out_ += static_cast<char>(0xdd);
+        push(true, out_.size());
+        out_.append(4, '\0');
+    }
+
+    void endArray()
+    {
+        const Frame frame = stack_.back();
+        stack_.pop_back();
+        for (int i = 0; i < 4; ++i)
+            out_[frame.lengthAt + i] = static_cast<char>((frame.count >> (24 - 8 * i)) & 0xFF);
+    }
+
+    void beginObject(size_t fields)
+    {
+        countValue();
+        if (fields < 16)
+            out_ += static_cast<char>(0x80 | fields);
+        else if (fields <= 0xFFFF)
+        {
+            out_ += static_cast<char>(0xde);
+            appendBigEndian(out_, fields, 2);
+        }
+        else
+        {
+            out_ += static_cast<char>(0xdf);
+            appendBigEndian(out_, fields, 4);
+        }
+        push(false, 0);
+    }
+
+    void endObject()
+    {
+        stack_.pop_back();
+    }
+
+    void key(const char *name)
+    {
+        writeString(name, std::strlen(name));
+    }
+
+    void number(double value)
+    {
+        countValue();
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        put(0xcb, bits, 8);
+    }
+
+    void integer(int64_t value)
+    {
+        countValue();
+        if (value >= 0)
+        {
+            if (value < 128)
+                out_ += static_cast<char>(value);
+            else if (value <= 0xFF)
+                put(0xcc, value, 1);
+            else if (value <= 0xFFFF)
+                put(0xcd, value, 2);
+            else if (value <= 0xFFFFFFFFLL)
+                put(0xce, value, 4);
+            else
+                put(0xcf, value, 8);
+        }
+        else if (value >= -32)
+            out_ += static_cast<char>(value);
+        else if (value >= INT8_MIN)
+            put(0xd0, static_cast<uint64_t>(value), 1);
+        else if (value >= INT16_MIN)
+            put(0xd1, static_cast<uint64_t>(value), 2);
+        else if (value >= INT32_MIN)
+            put(0xd2, static_cast<uint64_t>(value), 4);
+        else
+            put(0xd3, static_cast<uint64_t>(value), 8);
+    }
+
+    void string(const char *text, size_t length)
+    {
+        countValue();
+        writeString(text, length);
+    }
+
+    void string(const char *text)
+    {
+        string(text, std::strlen(text));
+    }
+
+    void null()
+    {
+        countValue();
+        out_ += static_cast<char>(0xc0);
+    }
+
+    void boolean(bool value)
+    {
+        countValue();
+        out_ += static_cast<char>(value ? 0xc3 : 0xc2);
+    }
+
+private:
+    struct Frame
+    {
+        bool isArray;
+        size_t lengthAt;
+        uint32_t count;
+    };
+
+    void push(bool isArray, size_t lengthAt)
+    {
+        stack_.push_back({isArray, lengthAt, 0});
+    }
+
+    // array elements are counted as they start; map entries were counted up front
+    void countValue()
+    {
+        if (!stack_.empty() && stack_.back().isArray)
+            ++stack_.back().count;
+    }
+
+    void put(unsigned char tag, uint64_t value, int bytes)
+    {
+        out_ += static_cast<char>(tag);
+        appendBigEndian(out_, value, bytes);
+    }
+
+    void writeString(const char *text, size_t length)
+    {
+        if (length < 32)
+            out_ += static_cast<char>(0xa0 | length);
+        else if (length <= 0xFF)
+            put(0xd9, length, 1);
+        else if (length <= 0xFFFF)
+            put(0xda, length, 2);
+        else
+            put(0xdb, length, 4);
+        out_.append(text, length);
+    }
+
+    std::string &out_;
+    std::vector<Frame> stack_; // open containers, innermost last
+};
+
+class CborWriter
+{
+public:
+    explicit CborWriter(std::string &out) : out_(out) {}
+
+    static constexpr const char *contentType = "application/cbor";
+
+    // arrays are streamed as indefinite length, closed by a break byte
+    void beginArray()
+    {
+        out_ += static_cast<char>(0x9f);
+    }
+
+    void endArray()
+    {
+        out_ += static_cast<char>(0xff);
+    }
+
+    void beginObject(size_t fields)
+    {
+        head(5, fields);
+    }
+
+    void endObject() {}
+
+    void key(const char *name)
+    {
+        string(name);
+    }
+
+    void number(double value)
+    {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        out_ += static_cast<char>(0xfb); // major type 7, double precision
+        appendBigEndian(out_, bits, 8);
+    }
+
+    void integer(int64_t value)
+    {
+        if (value >= 0)
+            head(0, static_cast<uint64_t>(value));
+        else
+            head(1, static_cast<uint64_t>(-1 - value));
+    }
+
+    void string(const char *text, size_t length)
+    {
+        head(3, length);
+        out_.append(text, length);
+    }
+
+    void string(const char *text)
+    {
+        string(text, std::strlen(text));
+    }
+
+    void null()
+    {
+        out_ += static_cast<char>(0xf6);
+    }
+
+    void boolean(bool value)
+    {
+        out_ += static_cast<char>(value ? 0xf5 : 0xf4);
+    }
+
+private:
+    // major type in the top 3 bits, then the shortest encoding of the argument
+    void head(unsigned major, uint64_t value)
+    {
+        char type = static_cast<char>(major << 5);
+        if (value < 24)
+            out_ += static_cast<char>(type | value);
+        else if (value <= 0xFF)
+        {
+            out_ += static_cast<char>(type | 24);
+            appendBigEndian(out_, value, 1);
+        }
+        else if (value <= 0xFFFF)
+        {
+            out_ += static_cast<char>(type | 25);
+            appendBigEndian(out_, value, 2);
+        }
+        else if (value <= 0xFFFFFFFFULL)
+        {
+            out_ += static_cast<char>(type | 26);
+            appendBigEndian(out_, value, 4);
+        }
+        else
+        {
+            out_ += static_cast<char>(type | 27);
+            appendBigEndian(out_, value, 8);
+        }
+    }
+
+    std::string &out_;
+};
+
+// picking the supported type an Accept header prefers, json otherwise
+//
+// ranges weigh their q ( 1 when absent, 0 means "not this one" ) and the
+// heaviest wins, the first listed among equals. */* and application/* stand
+// for json.
+inline ResponseFormat negotiateFormat(const std::string &accept)
+{
+    ResponseFormat best = ResponseFormat::Json;
+    double bestQ = 0;
+    size_t start = 0;
+    while (start < accept.size())
+    {
+        size_t end = accept.find(',', start);
+        if (end == std::string::npos)
+            end = accept.size();
+        std::string range = accept.substr(start, end - start);
+        start = end + 1;
+
+        size_t params = range.find(';');
+        size_t qAt = params == std::string::npos ? std::string::npos : range.find("q=", params);
+        double q = qAt == std::string::npos ? 1.0 : std::strtod(range.c_str() + qAt + 2, nullptr);
+        if (q <= bestQ)
+            continue;
+
+        size_t first = range.find_first_not_of(' ');
+        size_t last = range.find_last_not_of(' ', params == std::string::npos ? std::string::npos : params - 1);
+        if (first == std::string::npos || last == std::string::npos || last < first)
+            continue;
+
+        std::string type = range.substr(first, last - first + 1);
+        if (type == "application/json" || type == "*/*" || type == "application/*")
+            best = ResponseFormat::Json;
+        else if (type == "application/msgpack" || type == "application/x-msgpack" || type == "application/vnd.msgpack")
+            best = ResponseFormat::MsgPack;
+        else if (type == "application/cbor")
+            best = ResponseFormat::Cbor;
+        else
+            continue;
+        bestQ = q;
+    }
+    return best;
+}
+
+inline const char *formatContentType(ResponseFormat format)
+{
+    switch (format)
+    {
+    case ResponseFormat::MsgPack:
+        return MsgPackWriter::contentType;
+    case ResponseFormat::Cbor:
+        return CborWriter::contentType;
+    default:
+        return JsonWriter::contentType;
+    }
+}
+
+// running a document writer ( a generic lambda taking Writer & ) in the given format
+//
+template <class Write>
+std::string encodeBody(ResponseFormat format, Write &&write)
+{
+    std::string body;
+    switch (format)
+    {
+    case ResponseFormat::MsgPack:
+    {
+        MsgPackWriter writer(body);
+        write(writer);
+        break;
+    }
+    case ResponseFormat::Cbor:
+    {
+        CborWriter writer(body);
+        write(writer);
+        break;
+    }
+    default:
+    {
+        JsonWriter writer(body);
+        write(writer);
+        break;
+    }
+    }
+    return body;
+}
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "catalog_events.h"
+
+// newest reviews per book
+//
+// keeps up to kReviewCacheDepth of the most recent reviews for recently asked
+// books ( LRU over books ). a review write drops that book's entry. lists are
+// immutable once stored and handed out as shared pointers, so readers never
+// copy them under the lock.
+
+constexpr size_t kReviewCacheDepth = 50;
+constexpr size_t kReviewCacheBooks = 10000;
+
+struct CachedReview
+{
+    int id;
+    int rating;
+    std::string comment;
+    std::string username;
+};
+
+struct BookReviewList
+{
+    std::vector<CachedReview> newest; // newest first, at most kReviewCacheDepth
+    bool complete;                    // newest holds every review of the book
+};
+
+class ReviewListCache
+{
+public:
+    explicit ReviewListCache(size_t maxBooks = kReviewCacheBooks) : maxBooks_(maxBooks) {}
+
+    // the cached list for a book, if it can answer a request for `limit` reviews
+    //
+    std::shared_ptr<const BookReviewList> get(int bookId, size_t limit)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        auto entry = books_.find(bookId);
+        if (entry == books_.end())
+            return nullptr;
+        const auto &list = entry->second.list;
+        if (!list->complete && list->newest.size() < limit)
+            return nullptr;
+        lru_.splice(lru_.begin(), lru_, entry->second.lruPos);
+        return list;
+    }
+
+    // taken before reading from the database, handed back to put()
+    //
+    uint64_t generation() const
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return generation_;
+    }
+
+    // storing a list read at `generation`; dropped if a review was written since
+    //
+    void put(int bookId, BookReviewList list, uint64_t generation)
+    {
+        auto shared = std::make_shared<const BookReviewList>(std::move(list));
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation != generation_)
+            return;
+
+        auto entry = books_.find(bookId);
+        if (entry != books_.end())
+        {
+            entry->second.list = std::move(shared);
+            lru_.splice(lru_.begin(), lru_, entry->second.lruPos);
+            return;
+        }
+
+        if (books_.size() >= maxBooks_ && !lru_.empty())
+        {
+            books_.erase(lru_.back());
+            lru_.pop_back();
+        }
+        lru_.push_front(bookId);
+        books_[bookId] = {std::move(shared), lru_.begin()};
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_;
+        auto entry = books_.find(change.book_id);
+        if (entry != books_.end())
+        {
+            lru_.erase(entry->second.lruPos);
+            books_.erase(entry);
+        }
+    }
+
+private:
+    struct Entry
+    {
+        std::shared_ptr<const BookReviewList> list;
+        std::list<int>::iterator lruPos;
+    };
+
+    size_t maxBooks_;
+    mutable std::mutex mutex_;
+    uint64_t generation_ = 0;
+    std::list<int> lru_; // most recently used first
+    std::unordered_map<int, Entry> books_;
+};
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include "catalog_events.h"
+
+// which reviews each user wrote
+//
+// edit and delete only need "does this user own review X, and what was its
+// book and rating", so the answer is kept in memory per user ( LRU over
+// users ) and patched by review events. a miss reloads the user's reviews
+// through idx_reviews_user before saying no, so a stale set can cost a query
+// but never a wrong 403.
+
+constexpr size_t kOwnershipCacheUsers = 4096;
+
+struct OwnedReview
+{
+    int book_id;
+    int rating;
+    int64_t created_at;
+};
+
+class ReviewOwnershipCache
+{
+public:
+    explicit ReviewOwnershipCache(size_t maxUsers = kOwnershipCacheUsers) : maxUsers_(maxUsers) {}
+
+    // finding a review owned by userId, false if the user did not write it
+    //
+    bool find(sqlite3 *db, int userId, int reviewId, OwnedReview &out)
+    {
+        uint64_t generation;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto user = users_.find(userId);
+            if (user != users_.end())
+            {
+                lru_.splice(lru_.begin(), lru_, user->second.lruPos);
+                auto review = user->second.reviews.find(reviewId);
+                if (review != user->second.reviews.end())
+                {
+                    out = review->second;
+                    return true;
+                }
+            }
+            generation = generation_;
+        }
+
+        std::unordered_map<int, OwnedReview> reviews;
+        if (!load(db, userId, reviews))
+            return false;
+        auto review = reviews.find(reviewId);
+        bool found = review != reviews.end();
+        if (found)
+            out = review->second;
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (generation == generation_) // no review writes while loading, safe to keep
+            store(userId, std::move(reviews));
+        return found;
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++generation_;
+        auto user = users_.find(change.user_id);
+        if (user == users_.end())
+            return;
+
+        auto &reviews = user->second.reviews;
+        switch (change.kind)
+        {
+        case catalog::ReviewChange::Kind::Added:
+            reviews[change.review_id] = {change.book_id, change.rating, change.timestamp};
+            break;
+        case catalog::ReviewChange::Kind::Edited:
+        {
+            auto review = reviews.find(change.review_id);
+            if (review != reviews.end())
+                review->second.rating = change.rating;
+            break;
+        }
+        case catalog::ReviewChange::Kind::Deleted:
+            reviews.erase(change.review_id);
+            break;
+        }
+    }
+
+private:
+    struct UserReviews
+    {
+        std::unordered_map<int, OwnedReview> reviews;
+        std::list<int>::iterator lruPos;
+    };
+
+    static bool load(sqlite3 *db, int userId, std::unordered_map<int, OwnedReview> &out)
+    {
+        const char *sql = "SELECT id, book_id, rating, COALESCE(created_at, 0) FROM reviews WHERE user_id = ?;";
+        sqlite3_stmt *stmt = nullptr;
+        int rc = SQLITE_ERROR;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            sqlite3_bind_int(stmt, 1, userId);
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                out[sqlite3_column_int(stmt, 0)] = {sqlite3_column_int(stmt, 1), sqlite3_column_int(stmt, 2), sqlite3_column_int64(stmt, 3)};
+            }
+        }
+        sqlite3_finalize(stmt);
+        return rc == SQLITE_DONE;
+    }
+
+    // called with mutex_ held
+    void store(int userId, std::unordered_map<int, OwnedReview> reviews)
+    {
+        auto user = users_.find(userId);
+        if (user != users_.end())
+        {
+            user->second.reviews = std::move(reviews);
+            lru_.splice(lru_.begin(), lru_, user->second.lruPos);
+            return;
+        }
+
+        if (users_.size() >= maxUsers_ && !lru_.empty())
+        {
+            users_.erase(lru_.back());
+            lru_.pop_back();
+        }
+        lru_.push_front(userId);
+        users_[userId] = {std::move(reviews), lru_.begin()};
+    }
+
+    size_t maxUsers_;
+    std::mutex mutex_;
+    uint64_t generation_ = 0;
+    std::list<int> lru_; // most recently used first
+    std::unordered_map<int, UserReviews> users_;
+};
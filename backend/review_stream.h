@@ -0,0 +1,325 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "catalog_events.h"
+#include "json_writer.h"
+#include "review_timestamps.h"
+
+// live review events per book, for /books/<int>/reviews/stream
+//
+// crow writes a response only once it is complete, so the stream is served
+// as server-sent events in long-poll form: a request returns the events that
+// are pending ( or waits a while for one ) and ends, and EventSource
+// reconnects with Last-Event-ID. each book keeps a short ring of recent
+// events so nothing is lost between two requests; a client that fell behind
+// the ring gets a "reset" event and refetches the list.
+//
+// a waiting request holds no thread: its subscriber is parked with a
+// callback that ends the response, called by the publisher when an event
+// arrives or by the bus's timer thread when the wait is over.
+//
+// every event is rendered to its sse frame once and shared by all
+// subscribers. subscriber queues are bounded; a subscriber that lets its
+// queue fill up is evicted and has to reconnect.
+
+constexpr size_t kStreamRingSize = 256;      // events kept per book
+constexpr size_t kStreamQueueSize = 64;      // events queued per subscriber
+constexpr size_t kStreamMaxParked = 10000;   // requests waiting for events at once
+constexpr int kStreamIdleRingSeconds = 300;  // rings without subscribers are dropped after this
+
+using StreamFrame = std::shared_ptr<const std::string>;
+
+class ReviewEventBus
+{
+public:
+    // called once with the frames queued for a parked subscriber
+    using Deliver = std::function<void(std::vector<StreamFrame>)>;
+
+    class Subscriber
+    {
+    private:
+        friend class ReviewEventBus;
+
+        explicit Subscriber(int bookId) : bookId_(bookId) {}
+
+        int bookId_;
+        std::deque<StreamFrame> queue_; // the rest is guarded by the bus's mutex_
+        bool evicted_ = false;
+        Deliver deliver_; // set while parked
+        std::chrono::steady_clock::time_point expiresAt_;
+    };
+
+    struct Subscription
+    {
+        std::shared_ptr<Subscriber> subscriber;
+        std::vector<StreamFrame> missed; // events after the client's last id
+        bool reset;                      // the client's last id is too old to catch up from
+        uint64_t lastId;                 // newest event id when subscribing
+    };
+
+    // ids keep increasing across restarts, so an id from before a restart reads as too old
+    ReviewEventBus() : lastId_(static_cast<uint64_t>(unixNow()) * 1000000) {}
+
+    ~ReviewEventBus()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_all();
+        if (timer_.joinable())
+            timer_.join();
+    }
+
+    // starting the thread that ends parked requests whose wait is over
+    //
+    void start()
+    {
+        timer_ = std::thread([this]()
+                             { expireParked(); });
+    }
+
+    // registering for a book's events, lastEventId is 0 for a new client
+    //
+    Subscription subscribe(int bookId, uint64_t lastEventId)
+    {
+        Subscription subscription{std::shared_ptr<Subscriber>(new Subscriber(bookId)), {}, false, 0};
+        std::lock_guard<std::mutex> lock(mutex_);
+        Ring &ring = ringFor(bookId);
+        subscription.lastId = lastId_;
+        subscription.reset = lastEventId != 0 && (lastEventId < ring.droppedUpTo || lastEventId > lastId_);
+        if (lastEventId != 0 && !subscription.reset)
+        {
+            for (const auto &event : ring.events)
+            {
+                if (event.first > lastEventId)
+                    subscription.missed.push_back(event.second);
+            }
+        }
+        ring.subscribers.insert(subscription.subscriber.get());
+        return subscription;
+    }
+
+    void unsubscribe(const std::shared_ptr<Subscriber> &subscriber)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        detach(subscriber.get());
+    }
+
+    // waiting for the subscriber's next events without holding a thread
+    //
+    // deliver runs once: right here when events are already queued, else on
+    // the publishing thread or the timer thread ( with no frames once timeout
+    // passed ). the subscriber is unsubscribed before it runs. false, and
+    // deliver never runs, when too many requests are parked already.
+    bool park(const std::shared_ptr<Subscriber> &subscriber, std::chrono::milliseconds timeout, Deliver deliver)
+    {
+        std::vector<StreamFrame> frames;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (subscriber->queue_.empty() && !subscriber->evicted_)
+            {
+                if (parked_.size() >= kStreamMaxParked)
+                    return false;
+                subscriber->deliver_ = std::move(deliver);
+                subscriber->expiresAt_ = std::chrono::steady_clock::now() + timeout;
+                parked_.emplace(subscriber.get(), subscriber);
+                wake_.notify_one();
+                return true;
+            }
+            frames = takeFrames(subscriber.get());
+            detach(subscriber.get());
+        }
+        deliver(std::move(frames));
+        return true;
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        std::vector<std::pair<Deliver, std::vector<StreamFrame>>> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            publish(change, ready);
+        }
+        // responses end outside the lock
+        for (auto &delivery : ready)
+            delivery.first(std::move(delivery.second));
+    }
+
+private:
+    struct Ring
+    {
+        std::deque<std::pair<uint64_t, StreamFrame>> events;
+        uint64_t droppedUpTo; // events up to this id are no longer in the ring
+        std::unordered_set<Subscriber *> subscribers;
+        int64_t idleSince = 0;
+    };
+
+    // called with mutex_ held
+    void publish(const catalog::ReviewChange &change, std::vector<std::pair<Deliver, std::vector<StreamFrame>>> &ready)
+    {
+        sweepIdleRings();
+        auto ring = rings_.find(change.book_id);
+        if (ring == rings_.end())
+            return; // nobody watched this book recently
+
+        uint64_t id = ++lastId_;
+        StreamFrame frame = std::make_shared<const std::string>(render(id, change));
+        auto &events = ring->second.events;
+        events.emplace_back(id, frame);
+        if (events.size() > kStreamRingSize)
+        {
+            ring->second.droppedUpTo = events.front().first;
+            events.pop_front();
+        }
+
+        std::vector<Subscriber *> done;
+        for (Subscriber *subscriber : ring->second.subscribers)
+        {
+            if (subscriber->queue_.size() >= kStreamQueueSize)
+                subscriber->evicted_ = true; // too slow, it reconnects and catches up from the ring
+            else
+                subscriber->queue_.push_back(frame);
+            if (subscriber->evicted_ || subscriber->deliver_)
+                done.push_back(subscriber);
+        }
+        for (Subscriber *subscriber : done)
+        {
+            // an evicted subscriber that is not parked finds out when it parks
+            if (subscriber->deliver_)
+                ready.emplace_back(std::move(subscriber->deliver_), takeFrames(subscriber));
+            detach(subscriber);
+        }
+    }
+
+    // ending parked requests whose wait is over
+    void expireParked()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (!stopping_)
+        {
+            auto now = std::chrono::steady_clock::now();
+            auto next = now + std::chrono::seconds(1);
+            std::vector<std::pair<Deliver, std::vector<StreamFrame>>> ready;
+            for (auto it = parked_.begin(); it != parked_.end();)
+            {
+                Subscriber *subscriber = it->first;
+                ++it;
+                if (subscriber->expiresAt_ <= now)
+                {
+                    ready.emplace_back(std::move(subscriber->deliver_), takeFrames(subscriber));
+                    detach(subscriber); // may erase the entry just passed
+                }
+                else
+                    next = std::min(next, subscriber->expiresAt_);
+            }
+            if (!ready.empty())
+            {
+                lock.unlock();
+                for (auto &delivery : ready)
+                    delivery.first(std::move(delivery.second));
+                lock.lock();
+                continue;
+            }
+            wake_.wait_until(lock, next);
+        }
+    }
+
+    // called with mutex_ held
+    static std::vector<StreamFrame> takeFrames(Subscriber *subscriber)
+    {
+        std::vector<StreamFrame> frames(subscriber->queue_.begin(), subscriber->queue_.end());
+        subscriber->queue_.clear();
+        return frames;
+    }
+
+    // forgetting a subscriber, parked or not; called with mutex_ held
+    void detach(Subscriber *subscriber)
+    {
+        subscriber->deliver_ = nullptr;
+        auto ring = rings_.find(subscriber->bookId_);
+        if (ring != rings_.end())
+        {
+            ring->second.subscribers.erase(subscriber);
+            if (ring->second.subscribers.empty())
+                ring->second.idleSince = unixNow();
+        }
+        parked_.erase(subscriber); // last, it may hold the only reference
+    }
+
+    // called with mutex_ held
+    Ring &ringFor(int bookId)
+    {
+        auto ring = rings_.find(bookId);
+        if (ring == rings_.end())
+        {
+            // what happened before the ring existed is unknown
+            ring = rings_.emplace(bookId, Ring{{}, lastId_, {}, 0}).first;
+        }
+        return ring->second;
+    }
+
+    // called with mutex_ held
+    void sweepIdleRings()
+    {
+        int64_t now = unixNow();
+        if (now - lastSweep_ < 10)
+            return;
+        lastSweep_ = now;
+        for (auto it = rings_.begin(); it != rings_.end();)
+        {
+            const Ring &ring = it->second;
+            if (ring.subscribers.empty() && now - ring.idleSince > kStreamIdleRingSeconds)
+                it = rings_.erase(it);
+            else
+                ++it;
+        }
+    }
+
+    static std::string render(uint64_t id, const catalog::ReviewChange &change)
+    {
+        const char *kind = change.kind == catalog::ReviewChange::Kind::Added    ? "added"
+                           : change.kind == catalog::ReviewChange::Kind::Edited ? "edited"
+                                                                                : "deleted";
+        std::string data;
+        JsonWriter writer(data);
+        writer.beginObject(6);
+        writer.key("kind");
+        writer.string(kind);
+        writer.key("id");
+        writer.integer(change.review_id);
+        writer.key("book_id");
+        writer.integer(change.book_id);
+        writer.key("rating");
+        writer.integer(change.rating);
+        writer.key("comment");
+        writer.string(change.comment.data(), change.comment.size());
+        writer.key("username");
+        writer.string(change.username.data(), change.username.size());
+        writer.endObject();
+
+        // data never contains a raw newline, the writer escapes them
+        return "id: " + std::to_string(id) + "\nevent: review\ndata: " + data + "\n\n";
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    bool stopping_ = false;
+    std::thread timer_;
+    uint64_t lastId_;
+    int64_t lastSweep_ = 0;
+    std::unordered_map<int, Ring> rings_;
+    std::unordered_map<Subscriber *, std::shared_ptr<Subscriber>> parked_;
+};
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <iostream>
+#include <string>
+#include <thread>
+
+// created_at / updated_at on reviews
+//
+// unix seconds. databases created before the columns existed get them added
+// in place; their old rows are then backfilled in small batches by a
+// background thread so the table is never locked for long. old rows get 0,
+// meaning "written before timestamps were tracked".
+
+constexpr int kTimestampBackfillBatch = 1000;
+
+inline int64_t unixNow()
+{
+    return static_cast<int64_t>(std::time(nullptr));
+}
+
+inline bool tableHasColumn(sqlite3 *db, const char *table, const char *column)
+{
+    std::string sql = std::string("PRAGMA table_info(") + table + ");";
+    sqlite3_stmt *stmt = nullptr;
+    bool found = false;
+    if (sqlite3_prepare_v2(db, sql.c_str(), -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        while (!found && sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            const char *name = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+            found = name && std::string(name) == column;
+        }
+    }
+    sqlite3_finalize(stmt);
+    return found;
+}
+
+// adding the columns ( if missing ) and the index used by trending and backfill
+//
+inline bool migrateReviewTimestamps(sqlite3 *db)
+{
+    char *errMsg = nullptr;
+    for (const char *column : {"created_at", "updated_at"})
+    {
+        if (tableHasColumn(db, "reviews", column))
+            continue;
+        std::string sql = std::string("ALTER TABLE reviews ADD COLUMN ") + column + " INTEGER;";
+        if (sqlite3_exec(db, sql.c_str(), nullptr, 0, &errMsg) != SQLITE_OK)
+        {
+            std::cerr << "failed to add reviews." << column << ": " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            return false;
+        }
+    }
+
+    const char *sql_index = "CREATE INDEX IF NOT EXISTS idx_reviews_created_at ON reviews(created_at);";
+    if (sqlite3_exec(db, sql_index, nullptr, 0, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "failed to create reviews.created_at index: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+    return true;
+}
+
+// online backfill of rows without timestamps
+//
+class ReviewTimestampBackfill
+{
+public:
+    ~ReviewTimestampBackfill()
+    {
+        stop();
+    }
+
+    void start(const char *dbName)
+    {
+        worker_ = std::thread([this, db = std::string(dbName)]()
+                              { run(db); });
+    }
+
+    void stop()
+    {
+        stopping_ = true;
+        if (worker_.joinable())
+            worker_.join();
+    }
+
+private:
+    void run(const std::string &dbName)
+    {
+        sqlite3 *db;
+        if (sqlite3_open(dbName.c_str(), &db) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return;
+        }
+        sqlite3_busy_timeout(db, 2000);
+
+        const char *sql = R"(
+            UPDATE reviews SET created_at = 0, updated_at = COALESCE(updated_at, 0)
+            WHERE id IN (SELECT id FROM reviews WHERE created_at IS NULL LIMIT ?);
+        )";
+        sqlite3_stmt *stmt = nullptr;
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+        {
+            std::cerr << "timestamp backfill: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return;
+        }
+
+        long total = 0;
+        while (!stopping_)
+        {
+            sqlite3_bind_int(stmt, 1, kTimestampBackfillBatch);
+            int rc = sqlite3_step(stmt);
+            if (rc != SQLITE_DONE)
+            {
+                int primary = rc & 0xff;
+                if (primary == SQLITE_BUSY || primary == SQLITE_LOCKED)
+                {
+                    sqlite3_reset(stmt);
+                    std::this_thread::sleep_for(std::chrono::milliseconds(200)); // a writer holds the lock, retry
+                    continue;
+                }
+                // anything else ( corrupt, full disk, read-only ... ) will not go away by retrying
+                std::cerr << "timestamp backfill stopped after " << total << " reviews: " << sqlite3_errmsg(db) << std::endl;
+                break;
+            }
+            sqlite3_reset(stmt);
+            int changed = sqlite3_changes(db);
+            total += changed;
+            if (changed < kTimestampBackfillBatch)
+                break;
+            std::this_thread::sleep_for(std::chrono::milliseconds(10)); // let request writers in
+        }
+
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        if (total > 0)
+            std::cout << "backfilled timestamps on " << total << " reviews" << std::endl;
+    }
+
+    std::atomic<bool> stopping_{false};
+    std::thread worker_;
+};
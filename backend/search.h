@@ -0,0 +1,298 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <cctype>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// full-text search over books(title, summary) and reviews(comment)
+//
+// the FTS5 tables use external content ( no second copy of the text ) and are
+// kept in sync by triggers, so every write path, including bulk import, keeps
+// the index current without extra code.
+
+constexpr int kSearchDefaultLimit = 20;
+constexpr int kSearchMaxLimit = 100;
+
+// creating the fts tables and sync triggers, backfilling them on first run
+//
+inline bool ensureSearchSchema(sqlite3 *db)
+{
+    bool existed = false;
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, "SELECT 1 FROM sqlite_master WHERE type = 'table' AND name = 'books_fts';", -1, &stmt, nullptr) == SQLITE_OK)
+    {
+        existed = sqlite3_step(stmt) == SQLITE_ROW;
+    }
+    sqlite3_finalize(stmt);
+
+    const char *sql_fts = R"(
+        CREATE VIRTUAL TABLE IF NOT EXISTS books_fts USING fts5(
+            title, summary,
+            content = 'books', content_rowid = 'id',
+            tokenize = 'porter unicode61 remove_diacritics 2',
+            prefix = '2 3'
+        );
+
+        CREATE VIRTUAL TABLE IF NOT EXISTS reviews_fts USING fts5(
+            comment,
+            content = 'reviews', content_rowid = 'id',
+            tokenize = 'porter unicode61 remove_diacritics 2',
+            prefix = '2 3'
+        );
+
+        CREATE TRIGGER IF NOT EXISTS books_fts_ai AFTER INSERT ON books BEGIN
+            INSERT INTO books_fts(rowid, title, summary) VALUES (new.id, new.title, new.summary);
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS books_fts_ad AFTER DELETE ON books BEGIN
+            INSERT INTO books_fts(books_fts, rowid, title, summary) VALUES ('delete', old.id, old.title, old.summary);
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS books_fts_au AFTER UPDATE OF title, summary ON books BEGIN
+            INSERT INTO books_fts(books_fts, rowid, title, summary) VALUES ('delete', old.id, old.title, old.summary);
+            INSERT INTO books_fts(rowid, title, summary) VALUES (new.id, new.title, new.summary);
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS reviews_fts_ai AFTER INSERT ON reviews BEGIN
+            INSERT INTO reviews_fts(rowid, comment) VALUES (new.id, new.comment);
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS reviews_fts_ad AFTER DELETE ON reviews BEGIN
+            INSERT INTO reviews_fts(reviews_fts, rowid, comment) VALUES ('delete', old.id, old.comment);
+        END;
+
+        CREATE TRIGGER IF NOT EXISTS reviews_fts_au AFTER UPDATE OF comment ON reviews BEGIN
+            INSERT INTO reviews_fts(reviews_fts, rowid, comment) VALUES ('delete', old.id, old.comment);
+            INSERT INTO reviews_fts(rowid, comment) VALUES (new.id, new.comment);
+        END;
+    )";
+
+    char *errMsg = nullptr;
+    if (sqlite3_exec(db, sql_fts, nullptr, 0, &errMsg) != SQLITE_OK)
+    {
+        std::cerr << "failed to create search index: " << errMsg << std::endl;
+        sqlite3_free(errMsg);
+        return false;
+    }
+
+    if (!existed)
+    {
+        // titles weigh more than summaries when ranking
+        const char *sql_init = R"(
+            INSERT INTO books_fts(books_fts, rank) VALUES ('rank', 'bm25(10.0, 1.0)');
+            INSERT INTO books_fts(books_fts) VALUES ('rebuild');
+            INSERT INTO reviews_fts(reviews_fts) VALUES ('rebuild');
+        )";
+        if (sqlite3_exec(db, sql_init, nullptr, 0, &errMsg) != SQLITE_OK)
+        {
+            std::cerr << "failed to build search index: " << errMsg << std::endl;
+            sqlite3_free(errMsg);
+            return false;
+        }
+    }
+    return true;
+}
+
+// turning free text into a safe fts5 MATCH expression
+//
+// every word is quoted ( so user input can never be fts5 syntax ) and the last
+// one is a prefix match, which makes search-as-you-type work. words are ANDed.
+//
+inline std::string buildMatchQuery(const std::string &text)
+{
+    std::vector<std::string> words;
+    std::string word;
+    for (char c : text)
+    {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (std::isalnum(u) || u >= 0x80)
+        {
+            word += c;
+        }
+        else if (!word.empty())
+        {
+            words.push_back(std::move(word));
+            word.clear();
+        }
+    }
+    if (!word.empty())
+        words.push_back(std::move(word));
+
+    std::string match;
+    for (size_t i = 0; i < words.size(); ++i)
+    {
+        if (i > 0)
+            match += ' ';
+        match += '"' + words[i] + '"';
+        if (i + 1 == words.size())
+            match += '*';
+    }
+    return match;
+}
+
+inline std::string columnText(sqlite3_stmt *stmt, int col)
+{
+    const char *text = reinterpret_cast<const char *>(sqlite3_column_text(stmt, col));
+    return text ? text : "";
+}
+
+// turning fts highlight output into safe html
+//
+// fts5 marks matches with \x01 ... \x02 around the stored text; the text is
+// html-escaped and the marks become <b> ... </b>, so a title or comment can
+// never inject markup. stray marks in the text itself are dropped or closed,
+// the tags always balance.
+//
+inline std::string markedToHtml(const std::string &marked)
+{
+    std::string html;
+    html.reserve(marked.size() + 16);
+    bool open = false;
+    for (char c : marked)
+    {
+        switch (c)
+        {
+        case '\x01':
+            if (!open)
+                html += "<b>";
+            open = true;
+            break;
+        case '\x02':
+            if (open)
+                html += "</b>";
+            open = false;
+            break;
+        case '&':
+            html += "&amp;";
+            break;
+        case '<':
+            html += "&lt;";
+            break;
+        case '>':
+            html += "&gt;";
+            break;
+        case '"':
+            html += "&quot;";
+            break;
+        case '\'':
+            html += "&#39;";
+            break;
+        default:
+            html += c;
+        }
+    }
+    if (open)
+        html += "</b>";
+    return html;
+}
+
+// ranked book matches with highlighted title and summary snippet ( escaped html ), as "books": [...]
+//
+template <class Writer>
+bool searchBooks(sqlite3 *db, const std::string &match, int limit, int offset, Writer &writer)
+{
+    const char *sql = R"(
+        SELECT b.id, b.image_url,
+               highlight(books_fts, 0, char(1), char(2)),
+               snippet(books_fts, 1, char(1), char(2), '...', 24),
+               rank
+        FROM books_fts
+        JOIN books b ON b.id = books_fts.rowid
+        WHERE books_fts MATCH ?
+        ORDER BY rank
+        LIMIT ? OFFSET ?;
+    )";
+
+    writer.key("books");
+    writer.beginArray();
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        writer.endArray();
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, match.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, limit);
+    sqlite3_bind_int(stmt, 3, offset);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        writer.beginObject(5);
+        writer.key("id");
+        writer.integer(sqlite3_column_int(stmt, 0));
+        std::string image = columnText(stmt, 1);
+        writer.key("image");
+        writer.string(image.data(), image.size());
+        std::string title = markedToHtml(columnText(stmt, 2));
+        writer.key("title");
+        writer.string(title.data(), title.size());
+        std::string snippet = markedToHtml(columnText(stmt, 3));
+        writer.key("snippet");
+        writer.string(snippet.data(), snippet.size());
+        writer.key("score");
+        writer.number(-sqlite3_column_double(stmt, 4)); // bm25 is negative, lower is better
+        writer.endObject();
+    }
+    sqlite3_finalize(stmt);
+    writer.endArray();
+    return rc == SQLITE_DONE;
+}
+
+// ranked review matches with a highlighted comment snippet ( escaped html ), as "reviews": [...]
+//
+template <class Writer>
+bool searchReviews(sqlite3 *db, const std::string &match, int limit, int offset, Writer &writer)
+{
+    const char *sql = R"(
+        SELECT r.id, r.book_id, r.rating, u.username,
+               snippet(reviews_fts, 0, char(1), char(2), '...', 24),
+               rank
+        FROM reviews_fts
+        JOIN reviews r ON r.id = reviews_fts.rowid
+        JOIN users u ON u.id = r.user_id
+        WHERE reviews_fts MATCH ?
+        ORDER BY rank
+        LIMIT ? OFFSET ?;
+    )";
+
+    writer.key("reviews");
+    writer.beginArray();
+    sqlite3_stmt *stmt = nullptr;
+    if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) != SQLITE_OK)
+    {
+        writer.endArray();
+        return false;
+    }
+
+    sqlite3_bind_text(stmt, 1, match.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(stmt, 2, limit);
+    sqlite3_bind_int(stmt, 3, offset);
+
+    int rc;
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        writer.beginObject(6);
+        writer.key("id");
+        writer.integer(sqlite3_column_int(stmt, 0));
+        writer.key("book_id");
+        writer.integer(sqlite3_column_int(stmt, 1));
+        writer.key("rating");
+        writer.integer(sqlite3_column_int(stmt, 2));
+        std::string username = columnText(stmt, 3);
+        writer.key("username");
+        writer.string(username.data(), username.size());
+        std::string snippet = markedToHtml(columnText(stmt, 4));
+        writer.key("snippet");
+        writer.string(snippet.data(), snippet.size());
+        writer.key("score");
+        writer.number(-sqlite3_column_double(stmt, 5));
+        writer.endObject();
+    }
+    sqlite3_finalize(stmt);
+    writer.endArray();
+    return rc == SQLITE_DONE;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <chrono>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+// request coalescing: one computation per key at a time
+//
+// the first caller for a key ( the leader ) computes; callers arriving while
+// it runs wait for the same result instead of repeating the work. the key is
+// forgotten as soon as the leader is done, so nothing is cached: a caller
+// that arrives after the result was published computes again. a waiting
+// caller gives up at its own deadline; the leader keeps going for the others.
+
+enum class FlightRole
+{
+    Led,    // computed the value itself
+    Joined, // got the value of another caller's computation
+    GaveUp  // waited for another caller until `until` passed, no value
+};
+
+template <class Value>
+class SingleFlight
+{
+public:
+    // the value for `key`, waiting for a running computation no later than `until`
+    //
+    template <class Compute>
+    std::shared_ptr<const Value> run(const std::string &key, std::chrono::steady_clock::time_point until, Compute compute, FlightRole &role)
+    {
+        std::promise<std::shared_ptr<const Value>> promise;
+        std::shared_future<std::shared_ptr<const Value>> pending;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto flight = inflight_.find(key);
+            role = flight != inflight_.end() ? FlightRole::Joined : FlightRole::Led;
+            if (role == FlightRole::Joined)
+                pending = flight->second;
+            else
+                inflight_.emplace(key, promise.get_future().share());
+        }
+        if (role == FlightRole::Joined)
+        {
+            if (pending.wait_until(until) == std::future_status::timeout)
+            {
+                role = FlightRole::GaveUp;
+                return nullptr;
+            }
+            return pending.get();
+        }
+
+        std::shared_ptr<const Value> value;
+        try
+        {
+            value = compute();
+        }
+        catch (...)
+        {
+            forget(key);
+            promise.set_exception(std::current_exception());
+            throw;
+        }
+        forget(key);
+        promise.set_value(value);
+        return value;
+    }
+
+private:
+    void forget(const std::string &key)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        inflight_.erase(key);
+    }
+
+    std::mutex mutex_;
+    std::unordered_map<std::string, std::shared_future<std::shared_ptr<const Value>>> inflight_;
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cctype>
+#include <string>
+
+// normalizing titles for matching
+//
+// ascii letters are lowercased, punctuation becomes a space and runs of spaces
+// collapse to one; bytes of multi-byte UTF-8 characters are kept as they are.
+//
+inline std::string normalizeTitle(const std::string &title)
+{
+    std::string out;
+    out.reserve(title.size());
+    bool pendingSpace = false;
+
+    for (char c : title)
+    {
+        unsigned char u = static_cast<unsigned char>(c);
+        if (std::isalnum(u) || u >= 0x80)
+        {
+            if (pendingSpace && !out.empty())
+                out += ' ';
+            pendingSpace = false;
+            out += static_cast<char>(std::tolower(u));
+        }
+        else if (c != '\'')
+        {
+            pendingSpace = true;
+        }
+    }
+    return out;
+}
+
+// the normalized title without a leading article ( "the hobbit" -> "hobbit" ),
+// or an empty string when there is none
+//
+inline std::string withoutLeadingArticle(const std::string &normalized)
+{
+    for (const char *article : {"the ", "a ", "an "})
+    {
+        std::string a(article);
+        if (normalized.size() > a.size() && normalized.compare(0, a.size(), a) == 0)
+            return normalized.substr(a.size());
+    }
+    return "";
+}
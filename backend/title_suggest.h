@@ -0,0 +1,434 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "catalog_events.h"
+#include "rcu.h"
+#include "text_normalize.h"
+
+// title autocomplete
+//
+// an immutable, sorted array of normalized titles packed into one arena, plus
+// precomputed top lists for 1 and 2 byte prefixes ( the only ranges large
+// enough to be slow to rank on the fly ). snapshots are swapped through an
+// RcuCell, so lookups never lock; writers build a new snapshot on the side.
+
+constexpr size_t kSuggestMaxLimit = 20;
+
+struct SuggestSnapshot
+{
+    struct Entry
+    {
+        uint32_t keyOffset;
+        uint32_t keyLength;
+        uint32_t titleOffset;
+        uint32_t titleLength;
+        int32_t bookId;
+        uint32_t reviews;
+    };
+
+    std::string keys;           // normalized titles back to back
+    std::string titles;         // display titles back to back
+    std::vector<Entry> entries; // sorted by key
+    std::unordered_map<std::string, std::vector<uint32_t>> shortPrefixTop;
+    int maxBookId = 0;
+
+    std::string_view key(const Entry &e) const
+    {
+        return std::string_view(keys.data() + e.keyOffset, e.keyLength);
+    }
+
+    std::string_view title(const Entry &e) const
+    {
+        return std::string_view(titles.data() + e.titleOffset, e.titleLength);
+    }
+
+    // most reviewed first, then shorter titles, then lower ids
+    bool ranksBefore(uint32_t a, uint32_t b) const
+    {
+        const Entry &x = entries[a];
+        const Entry &y = entries[b];
+        if (x.reviews != y.reviews)
+            return x.reviews > y.reviews;
+        if (x.titleLength != y.titleLength)
+            return x.titleLength < y.titleLength;
+        return x.bookId < y.bookId;
+    }
+};
+
+struct SuggestMatch
+{
+    int bookId;
+    std::string title;
+    uint32_t reviews;
+};
+
+class TitleSuggestIndex
+{
+public:
+    struct Row
+    {
+        int bookId;
+        std::string title;
+        uint32_t reviews;
+    };
+
+    TitleSuggestIndex() = default;
+    TitleSuggestIndex(const TitleSuggestIndex &) = delete;
+    TitleSuggestIndex &operator=(const TitleSuggestIndex &) = delete;
+
+    // full build from the books table ( startup )
+    //
+    bool build(const char *dbName)
+    {
+        std::vector<Row> rows;
+        if (!loadRows(dbName, 0, rows, true))
+            return false;
+
+        std::lock_guard<std::mutex> lock(snapshot_.writerMutex());
+        snapshot_.publish(makeSnapshot(std::move(rows)));
+        return true;
+    }
+
+    // merging books added since the last snapshot
+    //
+    void addNewBooks(const char *dbName)
+    {
+        std::lock_guard<std::mutex> lock(snapshot_.writerMutex());
+        int since = 0;
+        std::vector<Row> rows;
+        {
+            auto current = snapshot_.read();
+            if (current)
+            {
+                since = current->maxBookId;
+                rows = rowsOf(*current);
+            }
+        }
+
+        std::vector<Row> added;
+        if (!loadRows(dbName, since, added, false) || added.empty())
+            return;
+
+        rows.insert(rows.end(), std::make_move_iterator(added.begin()), std::make_move_iterator(added.end()));
+        snapshot_.publish(makeSnapshot(std::move(rows)));
+    }
+
+    // catalog writes only flag that new books exist; the refresher thread
+    // merges them, so the re-sort never runs on the writer's thread and a
+    // bulk import is merged once per interval rather than once per chunk
+    //
+    void onBooksChanged()
+    {
+        std::lock_guard<std::mutex> lock(deltaMutex_);
+        newBooks_ = true;
+        deltaReady_.notify_one();
+    }
+
+    // review counts drift with every review write; they are batched and
+    // folded into a new snapshot by the refresher thread
+    //
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        int delta = change.kind == catalog::ReviewChange::Kind::Added     ? 1
+                    : change.kind == catalog::ReviewChange::Kind::Deleted ? -1
+                                                                          : 0;
+        if (delta == 0)
+            return;
+
+        std::lock_guard<std::mutex> lock(deltaMutex_);
+        pendingDeltas_[change.book_id] += delta;
+        deltaReady_.notify_one();
+    }
+
+    void startRefresher(const char *dbName, std::chrono::milliseconds interval)
+    {
+        refresher_ = std::thread([this, dbName, interval]()
+                                 {
+            for (;;)
+            {
+                std::unordered_map<int, int> deltas;
+                bool newBooks = false;
+                {
+                    std::unique_lock<std::mutex> lock(deltaMutex_);
+                    deltaReady_.wait(lock, [this] { return stopping_ || newBooks_ || !pendingDeltas_.empty(); });
+                    if (stopping_)
+                        return;
+                    deltaReady_.wait_for(lock, interval, [this] { return stopping_; }); // let writes pile up
+                    deltas.swap(pendingDeltas_);
+                    std::swap(newBooks, newBooks_);
+                }
+                if (newBooks)
+                    addNewBooks(dbName); // first, so deltas for the new books find them
+                if (!deltas.empty())
+                    applyDeltas(deltas);
+            } });
+    }
+
+    ~TitleSuggestIndex()
+    {
+        {
+            std::lock_guard<std::mutex> lock(deltaMutex_);
+            stopping_ = true;
+        }
+        deltaReady_.notify_all();
+        if (refresher_.joinable())
+            refresher_.join();
+    }
+
+    std::vector<SuggestMatch> suggest(const std::string &prefix, size_t limit) const
+    {
+        std::vector<SuggestMatch> matches;
+        std::string key = normalizeTitle(prefix);
+        limit = std::min(limit, kSuggestMaxLimit);
+        if (key.empty() || limit == 0)
+            return matches;
+
+        auto snap = snapshot_.read();
+        if (!snap)
+            return matches;
+
+        std::vector<uint32_t> ranked;
+        auto shortTop = snap->shortPrefixTop.find(key);
+        if (shortTop != snap->shortPrefixTop.end())
+        {
+            ranked = shortTop->second;
+        }
+        else
+        {
+            ranked = topInRange(*snap, key, limit * 2);
+        }
+
+        std::vector<int> seen;
+        for (uint32_t i : ranked)
+        {
+            const auto &e = snap->entries[i];
+            if (std::find(seen.begin(), seen.end(), e.bookId) != seen.end())
+                continue; // same book indexed with and without its article
+            seen.push_back(e.bookId);
+            matches.push_back({e.bookId, std::string(snap->title(e)), e.reviews});
+            if (matches.size() == limit)
+                break;
+        }
+        return matches;
+    }
+
+private:
+    static bool loadRows(const char *dbName, int sinceId, std::vector<Row> &rows, bool withCounts)
+    {
+        sqlite3 *db;
+        if (sqlite3_open(dbName, &db) != SQLITE_OK)
+        {
+            std::cerr << "suggest: cannot open database: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        // new books have no reviews yet unless this is the initial load
+        std::unordered_map<int, uint32_t> counts;
+        sqlite3_stmt *stmt = nullptr;
+        if (withCounts)
+        {
+            if (sqlite3_prepare_v2(db, "SELECT book_id, COUNT(*) FROM reviews GROUP BY book_id;", -1, &stmt, nullptr) == SQLITE_OK)
+            {
+                while (sqlite3_step(stmt) == SQLITE_ROW)
+                    counts[sqlite3_column_int(stmt, 0)] = static_cast<uint32_t>(sqlite3_column_int(stmt, 1));
+            }
+            sqlite3_finalize(stmt);
+        }
+
+        bool ok = false;
+        if (sqlite3_prepare_v2(db, "SELECT id, title FROM books WHERE id > ? ORDER BY id;", -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            sqlite3_bind_int(stmt, 1, sinceId);
+            int rc;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                int id = sqlite3_column_int(stmt, 0);
+                const char *title = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+                auto count = counts.find(id);
+                rows.push_back({id, title ? title : "", count == counts.end() ? 0u : count->second});
+            }
+            ok = rc == SQLITE_DONE;
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return ok;
+    }
+
+    // the distinct books of a snapshot ( entries hold some books twice )
+    //
+    static std::vector<Row> rowsOf(const SuggestSnapshot &snap)
+    {
+        std::vector<Row> rows;
+        std::vector<bool> seen(snap.maxBookId + 1, false);
+        for (const auto &e : snap.entries)
+        {
+            if (seen[e.bookId])
+                continue;
+            seen[e.bookId] = true;
+            rows.push_back({e.bookId, std::string(snap.title(e)), e.reviews});
+        }
+        return rows;
+    }
+
+    static std::unique_ptr<const SuggestSnapshot> makeSnapshot(std::vector<Row> rows)
+    {
+        auto snap = std::make_unique<SuggestSnapshot>();
+
+        struct Pending
+        {
+            std::string key;
+            size_t row;
+        };
+        std::vector<Pending> pending;
+        pending.reserve(rows.size() + rows.size() / 4);
+
+        for (size_t i = 0; i < rows.size(); ++i)
+        {
+            snap->maxBookId = std::max(snap->maxBookId, rows[i].bookId);
+            std::string key = normalizeTitle(rows[i].title);
+            if (key.empty())
+                continue;
+            std::string bare = withoutLeadingArticle(key);
+            pending.push_back({std::move(key), i});
+            if (!bare.empty())
+                pending.push_back({std::move(bare), i});
+        }
+        std::sort(pending.begin(), pending.end(), [](const Pending &a, const Pending &b)
+                  { return a.key < b.key; });
+
+        // display titles are stored once per book, keys once per entry
+        std::vector<uint32_t> titleOffset(rows.size(), UINT32_MAX);
+        snap->entries.reserve(pending.size());
+        for (const auto &p : pending)
+        {
+            const Row &row = rows[p.row];
+            if (titleOffset[p.row] == UINT32_MAX)
+            {
+                titleOffset[p.row] = static_cast<uint32_t>(snap->titles.size());
+                snap->titles += row.title;
+            }
+            SuggestSnapshot::Entry e;
+            e.keyOffset = static_cast<uint32_t>(snap->keys.size());
+            e.keyLength = static_cast<uint32_t>(p.key.size());
+            e.titleOffset = titleOffset[p.row];
+            e.titleLength = static_cast<uint32_t>(row.title.size());
+            e.bookId = row.bookId;
+            e.reviews = row.reviews;
+            snap->keys += p.key;
+            snap->entries.push_back(e);
+        }
+
+        computeShortPrefixTop(*snap);
+        return snap;
+    }
+
+    // top lists for every 1 and 2 byte prefix; entries sharing a prefix are
+    // contiguous because the array is sorted
+    //
+    static void computeShortPrefixTop(SuggestSnapshot &snap)
+    {
+        snap.shortPrefixTop.clear();
+        for (size_t len = 1; len <= 2; ++len)
+        {
+            size_t begin = 0;
+            while (begin < snap.entries.size())
+            {
+                std::string_view first = snap.key(snap.entries[begin]);
+                if (first.size() < len)
+                {
+                    ++begin;
+                    continue;
+                }
+                std::string_view prefix = first.substr(0, len);
+                size_t end = begin + 1;
+                while (end < snap.entries.size() && snap.key(snap.entries[end]).substr(0, len) == prefix)
+                    ++end;
+
+                std::vector<uint32_t> ids(end - begin);
+                for (size_t i = begin; i < end; ++i)
+                    ids[i - begin] = static_cast<uint32_t>(i);
+                size_t keep = std::min(ids.size(), kSuggestMaxLimit * 2);
+                std::partial_sort(ids.begin(), ids.begin() + keep, ids.end(), [&snap](uint32_t a, uint32_t b)
+                                  { return snap.ranksBefore(a, b); });
+                ids.resize(keep);
+                snap.shortPrefixTop.emplace(std::string(prefix), std::move(ids));
+                begin = end;
+            }
+        }
+    }
+
+    static std::vector<uint32_t> topInRange(const SuggestSnapshot &snap, const std::string &prefix, size_t k)
+    {
+        auto byKey = [&snap](const SuggestSnapshot::Entry &e, const std::string &p)
+        { return snap.key(e) < p; };
+        auto lo = std::lower_bound(snap.entries.begin(), snap.entries.end(), prefix, byKey);
+        auto hi = std::partition_point(lo, snap.entries.end(), [&](const SuggestSnapshot::Entry &e)
+                                       { return snap.key(e).substr(0, prefix.size()) == prefix; });
+
+        // bounded heap of the best k; the heap top is the worst kept entry
+        auto worse = [&snap](uint32_t a, uint32_t b)
+        { return snap.ranksBefore(a, b); };
+        std::vector<uint32_t> heap;
+        heap.reserve(k + 1);
+        for (auto it = lo; it != hi; ++it)
+        {
+            uint32_t i = static_cast<uint32_t>(it - snap.entries.begin());
+            if (heap.size() < k)
+            {
+                heap.push_back(i);
+                std::push_heap(heap.begin(), heap.end(), worse);
+            }
+            else if (snap.ranksBefore(i, heap.front()))
+            {
+                std::pop_heap(heap.begin(), heap.end(), worse);
+                heap.back() = i;
+                std::push_heap(heap.begin(), heap.end(), worse);
+            }
+        }
+        std::sort_heap(heap.begin(), heap.end(), worse);
+        return heap;
+    }
+
+    void applyDeltas(const std::unordered_map<int, int> &deltas)
+    {
+        std::lock_guard<std::mutex> lock(snapshot_.writerMutex());
+        std::unique_ptr<SuggestSnapshot> next;
+        {
+            auto current = snapshot_.read();
+            if (!current)
+                return;
+            next = std::make_unique<SuggestSnapshot>(*current);
+        }
+
+        for (auto &e : next->entries)
+        {
+            auto delta = deltas.find(e.bookId);
+            if (delta != deltas.end())
+                e.reviews = static_cast<uint32_t>(std::max<int64_t>(0, static_cast<int64_t>(e.reviews) + delta->second));
+        }
+        computeShortPrefixTop(*next);
+        snapshot_.publish(std::move(next));
+    }
+
+    RcuCell<SuggestSnapshot> snapshot_;
+    std::mutex deltaMutex_;
+    std::condition_variable deltaReady_;
+    std::unordered_map<int, int> pendingDeltas_;
+    bool newBooks_ = false;
+    bool stopping_ = false;
+    std::thread refresher_;
+};
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "catalog_events.h"
+
+// trending books
+//
+// each book has an exponentially decayed count of new reviews. all books
+// decay at the same rate, so scores are kept relative to a fixed reference
+// time: a review written at t adds 2^((t - reference) / halfLife), and the
+// ranking never changes just because time passes. an update is O(1); the
+// reference is moved forward ( rescaling every score ) only when the weights
+// grow too large for a double.
+
+constexpr double kTrendingHalfLifeSeconds = 3 * 24 * 3600.0;
+constexpr size_t kTrendingMaxK = 50;
+
+struct TrendingBook
+{
+    int bookId;
+    double score; // decayed review count as of now
+};
+
+class TrendingBooks
+{
+public:
+    explicit TrendingBooks(double halfLifeSeconds = kTrendingHalfLifeSeconds) : halfLife_(halfLifeSeconds) {}
+
+    // seeding from reviews recent enough to still matter
+    //
+    bool load(const char *dbName, int64_t now)
+    {
+        sqlite3 *db;
+        if (sqlite3_open_v2(dbName, &db, SQLITE_OPEN_READONLY, nullptr) != SQLITE_OK)
+        {
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        sqlite3_stmt *stmt = nullptr;
+        int rc = SQLITE_ERROR;
+        const char *sql = "SELECT book_id, created_at FROM reviews WHERE created_at >= ?;";
+        if (sqlite3_prepare_v2(db, sql, -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            sqlite3_bind_int64(stmt, 1, now - static_cast<int64_t>(20 * halfLife_));
+            std::lock_guard<std::mutex> lock(mutex_);
+            reference_ = now;
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+                add(sqlite3_column_int(stmt, 0), sqlite3_column_int64(stmt, 1), 1.0);
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        return rc == SQLITE_DONE;
+    }
+
+    void onReviewChanged(const catalog::ReviewChange &change)
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (change.kind == catalog::ReviewChange::Kind::Added)
+            add(change.book_id, change.timestamp, 1.0);
+        else if (change.kind == catalog::ReviewChange::Kind::Deleted && change.timestamp > 0)
+            add(change.book_id, change.timestamp, -1.0); // take back what the insert added
+    }
+
+    std::vector<TrendingBook> top(size_t k, int64_t now) const
+    {
+        std::vector<TrendingBook> books;
+        k = std::min(k, kTrendingMaxK);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        double decay = std::exp2(-(now - reference_) / halfLife_);
+        books.reserve(scores_.size());
+        for (const auto &entry : scores_)
+        {
+            if (entry.second * decay > 1e-3)
+                books.push_back({entry.first, entry.second});
+        }
+        size_t keep = std::min(k, books.size());
+        std::partial_sort(books.begin(), books.begin() + keep, books.end(), [](const TrendingBook &a, const TrendingBook &b)
+                          {
+            if (a.score != b.score)
+                return a.score > b.score;
+            return a.bookId < b.bookId; });
+        books.resize(keep);
+        for (auto &book : books)
+            book.score *= decay;
+        return books;
+    }
+
+private:
+    // called with mutex_ held
+    void add(int bookId, int64_t at, double weight)
+    {
+        double exponent = (at - reference_) / halfLife_;
+        if (exponent > 512)
+        {
+            rebase(at);
+            exponent = 0;
+        }
+
+        double &score = scores_[bookId];
+        score += weight * std::exp2(exponent);
+        if (score <= 1e-9)
+            scores_.erase(bookId);
+    }
+
+    // moving the reference to `at`, dropping books that decayed to nothing
+    void rebase(int64_t at)
+    {
+        double factor = std::exp2(-(at - reference_) / halfLife_);
+        for (auto it = scores_.begin(); it != scores_.end();)
+        {
+            it->second *= factor;
+            if (it->second < 1e-6)
+                it = scores_.erase(it);
+            else
+                ++it;
+        }
+        reference_ = at;
+    }
+
+    double halfLife_;
+    mutable std::mutex mutex_;
+    int64_t reference_ = 0;
+    std::unordered_map<int, double> scores_;
+};
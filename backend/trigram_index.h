@@ -0,0 +1,416 @@
+#pragma once
+
+#include <sqlite3.h>
+#include <algorithm>
+#include <cmath>
+#include <condition_variable>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "rcu.h"
+#include "text_normalize.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TRIGRAM_HAVE_X86 1
+#endif
+
+// trigram fuzzy title matching
+//
+// every normalized title is broken into pg_trgm style trigrams ( each word is
+// padded as "  word " ). posting lists hold document numbers, delta + varint
+// encoded in one byte arena. a query only scans the shortest posting lists
+// that could still reach the similarity threshold, then checks the remaining
+// candidates against the longer lists with a sorted-set intersection ( AVX2
+// when the cpu has it ).
+
+constexpr double kFuzzyDefaultThreshold = 0.5;
+constexpr size_t kFuzzyMaxLimit = 50;
+
+// trigrams of a normalized title, sorted and unique
+//
+inline std::vector<uint32_t> titleTrigrams(const std::string &normalized)
+{
+    std::vector<uint32_t> grams;
+    size_t start = 0;
+    while (start < normalized.size())
+    {
+        size_t end = normalized.find(' ', start);
+        if (end == std::string::npos)
+            end = normalized.size();
+
+        std::string padded = "  " + normalized.substr(start, end - start) + " ";
+        for (size_t i = 0; i + 3 <= padded.size(); ++i)
+        {
+            grams.push_back((static_cast<uint32_t>(static_cast<unsigned char>(padded[i])) << 16) |
+                            (static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 1])) << 8) |
+                            static_cast<uint32_t>(static_cast<unsigned char>(padded[i + 2])));
+        }
+        start = end + 1;
+    }
+    std::sort(grams.begin(), grams.end());
+    grams.erase(std::unique(grams.begin(), grams.end()), grams.end());
+    return grams;
+}
+
+// sorted set intersection, scalar version
+//
+inline size_t intersectScalar(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out)
+{
+    size_t i = 0, j = 0, n = 0;
+    while (i < na && j < nb)
+    {
+        if (a[i] < b[j])
+            ++i;
+        else if (b[j] < a[i])
+            ++j;
+        else
+        {
+            out[n++] = a[i];
+            ++i;
+            ++j;
+        }
+    }
+    return n;
+}
+
+#ifdef TRIGRAM_HAVE_X86
+// sorted set intersection, 8x8 block compare with AVX2
+//
+// each block of a is compared against all eight rotations of the current block
+// of b; whichever block ends lower is advanced. values are unique in both
+// inputs, so an element of a can match in at most one block of b.
+//
+__attribute__((target("avx2"))) inline size_t intersectAvx2(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out)
+{
+    size_t i = 0, j = 0, n = 0;
+    const __m256i rot1 = _mm256_setr_epi32(1, 2, 3, 4, 5, 6, 7, 0);
+
+    while (i + 8 <= na && j + 8 <= nb)
+    {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(a + i));
+        __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(b + j));
+
+        __m256i hit = _mm256_cmpeq_epi32(va, vb);
+        for (int r = 1; r < 8; ++r)
+        {
+            vb = _mm256_permutevar8x32_epi32(vb, rot1);
+            hit = _mm256_or_si256(hit, _mm256_cmpeq_epi32(va, vb));
+        }
+
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_castsi256_ps(hit)));
+        while (mask)
+        {
+            out[n++] = a[i + __builtin_ctz(mask)];
+            mask &= mask - 1;
+        }
+
+        uint32_t lastA = a[i + 7], lastB = b[j + 7];
+        if (lastA <= lastB)
+            i += 8;
+        if (lastB <= lastA)
+            j += 8;
+    }
+    return n + intersectScalar(a + i, na - i, b + j, nb - j, out + n);
+}
+#endif
+
+inline size_t intersectSorted(const uint32_t *a, size_t na, const uint32_t *b, size_t nb, uint32_t *out)
+{
+#ifdef TRIGRAM_HAVE_X86
+    static const bool hasAvx2 = __builtin_cpu_supports("avx2");
+    if (hasAvx2)
+        return intersectAvx2(a, na, b, nb, out);
+#endif
+    return intersectScalar(a, na, b, nb, out);
+}
+
+struct TrigramSnapshot
+{
+    struct Doc
+    {
+        int32_t bookId;
+        uint32_t titleOffset;
+        uint32_t titleLength;
+        uint32_t trigramCount;
+    };
+
+    struct Posting
+    {
+        uint32_t offset; // into postingBytes
+        uint32_t bytes;
+        uint32_t count;
+    };
+
+    std::vector<Doc> docs;
+    std::string titles;
+    std::string postingBytes;
+    std::unordered_map<uint32_t, Posting> postings;
+
+    size_t memoryBytes() const
+    {
+        return docs.capacity() * sizeof(Doc) + titles.capacity() + postingBytes.capacity() +
+               postings.size() * (sizeof(uint32_t) + sizeof(Posting) + 2 * sizeof(void *));
+    }
+
+    void decode(const Posting &p, std::vector<uint32_t> &out) const
+    {
+        out.resize(p.count);
+        const unsigned char *in = reinterpret_cast<const unsigned char *>(postingBytes.data()) + p.offset;
+        uint32_t value = 0;
+        for (uint32_t k = 0; k < p.count; ++k)
+        {
+            uint32_t delta = 0;
+            int shift = 0;
+            unsigned char byte;
+            do
+            {
+                byte = *in++;
+                delta |= static_cast<uint32_t>(byte & 0x7F) << shift;
+                shift += 7;
+            } while (byte & 0x80);
+            value += delta;
+            out[k] = value;
+        }
+    }
+};
+
+struct FuzzyMatch
+{
+    int bookId;
+    std::string title;
+    double similarity;
+};
+
+class TrigramIndex
+{
+public:
+    TrigramIndex() = default;
+    TrigramIndex(const TrigramIndex &) = delete;
+    TrigramIndex &operator=(const TrigramIndex &) = delete;
+
+    ~TrigramIndex()
+    {
+        {
+            std::lock_guard<std::mutex> lock(staleMutex_);
+            stopping_ = true;
+        }
+        staleReady_.notify_all();
+        if (rebuilder_.joinable())
+            rebuilder_.join();
+    }
+
+    // (re)building from the books table
+    //
+    bool build(const char *dbName)
+    {
+        sqlite3 *db;
+        if (sqlite3_open(dbName, &db) != SQLITE_OK)
+        {
+            std::cerr << "trigram: cannot open database: " << sqlite3_errmsg(db) << std::endl;
+            sqlite3_close(db);
+            return false;
+        }
+        sqlite3_busy_timeout(db, 5000);
+
+        auto snap = std::make_unique<TrigramSnapshot>();
+        std::unordered_map<uint32_t, std::vector<uint32_t>> lists;
+
+        sqlite3_stmt *stmt = nullptr;
+        int rc = SQLITE_ERROR;
+        if (sqlite3_prepare_v2(db, "SELECT id, title FROM books ORDER BY id;", -1, &stmt, nullptr) == SQLITE_OK)
+        {
+            while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+            {
+                const char *title = reinterpret_cast<const char *>(sqlite3_column_text(stmt, 1));
+                std::string text = title ? title : "";
+                std::vector<uint32_t> grams = titleTrigrams(normalizeTitle(text));
+                if (grams.empty())
+                    continue;
+
+                uint32_t docNo = static_cast<uint32_t>(snap->docs.size());
+                snap->docs.push_back({sqlite3_column_int(stmt, 0), static_cast<uint32_t>(snap->titles.size()),
+                                      static_cast<uint32_t>(text.size()), static_cast<uint32_t>(grams.size())});
+                snap->titles += text;
+                for (uint32_t g : grams)
+                    lists[g].push_back(docNo); // doc numbers arrive in order, lists stay sorted
+            }
+        }
+        sqlite3_finalize(stmt);
+        sqlite3_close(db);
+        if (rc != SQLITE_DONE)
+            return false;
+
+        snap->postings.reserve(lists.size());
+        for (auto &entry : lists)
+        {
+            TrigramSnapshot::Posting p{static_cast<uint32_t>(snap->postingBytes.size()), 0, static_cast<uint32_t>(entry.second.size())};
+            uint32_t previous = 0;
+            for (uint32_t docNo : entry.second)
+            {
+                uint32_t delta = docNo - previous;
+                previous = docNo;
+                while (delta >= 0x80)
+                {
+                    snap->postingBytes += static_cast<char>((delta & 0x7F) | 0x80);
+                    delta >>= 7;
+                }
+                snap->postingBytes += static_cast<char>(delta);
+            }
+            p.bytes = static_cast<uint32_t>(snap->postingBytes.size()) - p.offset;
+            snap->postings.emplace(entry.first, p);
+            std::vector<uint32_t>().swap(entry.second);
+        }
+
+        std::cout << "trigram index: " << snap->docs.size() << " titles, " << snap->postings.size() << " trigrams, "
+                  << snap->memoryBytes() / 1024 << " KiB" << std::endl;
+
+        std::lock_guard<std::mutex> lock(snapshot_.writerMutex());
+        snapshot_.publish(std::move(snap));
+        return true;
+    }
+
+    // catalog writes only mark the index stale; the rebuilder thread builds a
+    // new snapshot off the writer's thread, once for any number of writes that
+    // arrived while it was busy. searches see the old titles until then
+    //
+    void onBooksChanged()
+    {
+        std::lock_guard<std::mutex> lock(staleMutex_);
+        stale_ = true;
+        staleReady_.notify_one();
+    }
+
+    void startRebuilder(const char *dbName)
+    {
+        rebuilder_ = std::thread([this, dbName]()
+                                 {
+            for (;;)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(staleMutex_);
+                    staleReady_.wait(lock, [this] { return stopping_ || stale_; });
+                    if (stopping_)
+                        return;
+                    stale_ = false;
+                }
+                build(dbName);
+            } });
+    }
+
+    size_t memoryBytes() const
+    {
+        auto snap = snapshot_.read();
+        return snap ? snap->memoryBytes() : 0;
+    }
+
+    // titles sharing at least threshold of the query's trigrams
+    //
+    std::vector<FuzzyMatch> search(const std::string &query, size_t limit, size_t offset = 0, double threshold = kFuzzyDefaultThreshold) const
+    {
+        std::vector<FuzzyMatch> matches;
+        std::vector<uint32_t> queryGrams = titleTrigrams(normalizeTitle(query));
+        auto snap = snapshot_.read();
+        if (!snap || queryGrams.empty() || limit == 0)
+            return matches;
+
+        // posting lists, shortest first; trigrams that occur nowhere still count
+        // towards the query size but contribute no list
+        thread_local std::vector<std::vector<uint32_t>> lists;
+        size_t listCount = 0;
+        for (uint32_t g : queryGrams)
+        {
+            auto posting = snap->postings.find(g);
+            if (posting == snap->postings.end())
+                continue;
+            if (lists.size() <= listCount)
+                lists.emplace_back();
+            snap->decode(posting->second, lists[listCount++]);
+        }
+        std::sort(lists.begin(), lists.begin() + listCount, [](const std::vector<uint32_t> &a, const std::vector<uint32_t> &b)
+                  { return a.size() < b.size(); });
+
+        // a doc needs at least minShared common trigrams, so it must appear in
+        // one of the ( listCount - minShared + 1 ) shortest lists
+        size_t querySize = queryGrams.size();
+        size_t minShared = std::max<size_t>(1, static_cast<size_t>(std::ceil(threshold * querySize)));
+        if (minShared > listCount)
+            return matches;
+        size_t scanLists = listCount - minShared + 1;
+
+        thread_local std::vector<uint16_t> counts;
+        thread_local std::vector<uint32_t> candidates;
+        thread_local std::vector<uint32_t> common;
+        if (counts.size() < snap->docs.size())
+            counts.assign(snap->docs.size(), 0);
+
+        candidates.clear();
+        for (size_t l = 0; l < scanLists; ++l)
+        {
+            for (uint32_t docNo : lists[l])
+            {
+                if (counts[docNo]++ == 0)
+                    candidates.push_back(docNo);
+            }
+        }
+        std::sort(candidates.begin(), candidates.end());
+
+        for (size_t l = scanLists; l < listCount; ++l)
+        {
+            common.resize(std::min(candidates.size(), lists[l].size()));
+            size_t n = intersectSorted(candidates.data(), candidates.size(), lists[l].data(), lists[l].size(), common.data());
+            for (size_t k = 0; k < n; ++k)
+                ++counts[common[k]];
+        }
+
+        // ranked by how much of the query the title covers ( so a short query
+        // can still match a long title ), ties broken by jaccard similarity
+        struct Scored
+        {
+            uint32_t docNo;
+            double coverage;
+            double jaccard;
+        };
+        std::vector<Scored> scored;
+        for (uint32_t docNo : candidates)
+        {
+            uint32_t shared = counts[docNo];
+            counts[docNo] = 0;
+            if (shared < minShared)
+                continue;
+            double coverage = static_cast<double>(shared) / querySize;
+            double jaccard = static_cast<double>(shared) / (querySize + snap->docs[docNo].trigramCount - shared);
+            scored.push_back({docNo, coverage, jaccard});
+        }
+
+        size_t keep = std::min(scored.size(), offset + limit);
+        std::partial_sort(scored.begin(), scored.begin() + keep, scored.end(), [&snap](const Scored &a, const Scored &b)
+                          {
+            if (a.coverage != b.coverage)
+                return a.coverage > b.coverage;
+            if (a.jaccard != b.jaccard)
+                return a.jaccard > b.jaccard;
+            return snap->docs[a.docNo].bookId < snap->docs[b.docNo].bookId; });
+
+        for (size_t k = offset; k < keep; ++k)
+        {
+            const auto &doc = snap->docs[scored[k].docNo];
+            matches.push_back({doc.bookId, snap->titles.substr(doc.titleOffset, doc.titleLength), scored[k].coverage});
+        }
+        return matches;
+    }
+
+private:
+    RcuCell<TrigramSnapshot> snapshot_;
+    std::mutex staleMutex_;
+    std::condition_variable staleReady_;
+    bool stale_ = false;
+    bool stopping_ = false;
+    std::thread rebuilder_;
+};
@@ -39,7 +39,7 @@ class BooksBloc extends Bloc<BooksEvent, BooksState> {
       emit(BooksLoading());
 
       try {
-        final response = await _dio.get('$baseUrl/books');
+        final response = await _dio.get('$baseUrl/books?summary_max=0');
 
         final List<dynamic> data = response.data;
 